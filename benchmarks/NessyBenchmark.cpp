@@ -0,0 +1,303 @@
+// NessyBenchmark: Headless throughput benchmark for NessyAPU::process
+// GPL-3.0
+//
+// Renders a grid of sample rates, block sizes, chip configurations, render
+// modes and note densities, and reports ns/sample and realtime factor for
+// each case. Results go to stdout and, optionally, to CSV and JSON files.
+// --stack instead renders chip stacks of growing size, serially and on the
+// worker pool, to show how the stack scales across cores.
+//
+// Usage: NessyBenchmark [--quick] [--seconds S] [--repeats N]
+//                       [--csv FILE] [--json FILE] [--stack]
+
+#include "ChipStack.h"
+#include "NessyAPU.h"
+#include "TestUtil.h"
+#include "VoiceAllocator.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Case {
+  double sampleRate;
+  int blockSize;
+  bool vrc6;
+  NessyAPU::RenderMode mode;
+  int notesPerSecond; // 0 = one chord held for the whole run
+};
+
+struct Result {
+  Case c;
+  double nsPerSample;
+  double realtimeFactor;
+};
+
+// Small deterministic generator, so every run plays the same notes
+struct Lcg {
+  uint32_t state = 12345;
+  uint32_t next() {
+    state = state * 1664525u + 1013904223u;
+    return state >> 8;
+  }
+};
+
+// Keeps the compiler from discarding the rendered audio
+volatile float g_sink = 0.0f;
+
+// Renders one case and returns the wall-clock time in seconds
+double renderCase(const Case &c, double seconds) {
+  NessyAPU apu;
+  VoiceAllocator voices;
+  voices.setAPU(&apu);
+
+  apu.initialize(c.sampleRate);
+  apu.setRenderMode(c.mode);
+  apu.setVRC6Enabled(c.vrc6);
+  voices.setVRC6Enabled(c.vrc6);
+
+  const int totalSamples = static_cast<int>(seconds * c.sampleRate);
+  const int noteInterval =
+      c.notesPerSecond > 0
+          ? std::max(1, static_cast<int>(c.sampleRate / c.notesPerSecond))
+          : totalSamples + 1;
+
+  std::vector<float> left(static_cast<size_t>(c.blockSize));
+  std::vector<float> right(static_cast<size_t>(c.blockSize));
+
+  Lcg rng;
+  int heldNotes[4] = {-1, -1, -1, -1};
+  int nextVoice = 0;
+  int nextEvent = noteInterval;
+
+  // Start with a chord plus noise, so every case has audible channels
+  const int chord[] = {48, 55, 60, 64, 67, 72};
+  for (int note : chord)
+    voices.noteOn(0, note, 0.8f);
+  apu.noteOn(NessyAPU::NOISE, 60, 0.5f);
+
+  const auto start = std::chrono::steady_clock::now();
+
+  for (int pos = 0; pos < totalSamples; pos += c.blockSize) {
+    const int blockEnd = std::min(pos + c.blockSize, totalSamples);
+    int rendered = pos;
+
+    // Render up to each note event, as the plugin does
+    while (nextEvent < blockEnd) {
+      if (nextEvent > rendered) {
+        apu.process(left.data() + (rendered - pos),
+                    right.data() + (rendered - pos), nextEvent - rendered);
+        rendered = nextEvent;
+      }
+
+      int &slot = heldNotes[nextVoice];
+      if (slot >= 0)
+        voices.noteOff(0, slot);
+      slot = 36 + static_cast<int>(rng.next() % 60);
+      voices.noteOn(0, slot, 0.5f + (rng.next() % 50) / 100.0f);
+      nextVoice = (nextVoice + 1) % 4;
+      nextEvent += noteInterval;
+    }
+
+    if (blockEnd > rendered)
+      apu.process(left.data() + (rendered - pos),
+                  right.data() + (rendered - pos), blockEnd - rendered);
+
+    g_sink = g_sink + left[0];
+  }
+
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+// Renders a chip stack holding three notes per chip and returns the
+// wall-clock time in seconds
+double renderStack(int numChips, int &numWorkers, double seconds) {
+  constexpr double sampleRate = 48000.0;
+  constexpr int blockSize = 256;
+
+  ChipStack chips(numWorkers);
+  VoiceAllocator voices;
+  chips.initialize(sampleRate);
+  chips.prepareWorkers(numChips);
+  chips.setNumChips(numChips);
+  numWorkers = chips.getNumWorkers();
+  voices.setAPUs(chips.getChips(), ChipStack::MAX_CHIPS);
+  voices.setNumChips(numChips);
+  for (int i = 0; i < numChips * 3; ++i)
+    voices.noteOn(0, 40 + i, 0.5f);
+
+  const int totalSamples = static_cast<int>(seconds * sampleRate);
+  std::vector<float> left(blockSize), right(blockSize);
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int pos = 0; pos < totalSamples; pos += blockSize) {
+    chips.process(left.data(), right.data(), blockSize);
+    g_sink = g_sink + left[0];
+  }
+  const auto end = std::chrono::steady_clock::now();
+  return std::chrono::duration<double>(end - start).count();
+}
+
+int runStackBenchmark(double seconds, int repeats) {
+  std::printf("%6s %8s %12s %10s\n", "chips", "workers", "ns/sample",
+              "realtime");
+  const int samples = static_cast<int>(seconds * 48000.0);
+  for (int numChips : {1, 2, 4, 8}) {
+    for (int requested : {0, -1}) {
+      int numWorkers = requested;
+      double best = renderStack(numChips, numWorkers, seconds);
+      for (int i = 1; i < repeats; ++i) {
+        numWorkers = requested;
+        best = std::min(best, renderStack(numChips, numWorkers, seconds));
+      }
+      std::printf("%6d %8d %12.2f %9.0fx\n", numChips, numWorkers,
+                  best * 1e9 / samples, seconds / best);
+      std::fflush(stdout);
+    }
+  }
+
+  const int unprioritized = RealtimeWorkerPool::shared().getNumUnprioritized();
+  if (unprioritized > 0)
+    std::printf("note: %d of %d workers run at normal priority\n",
+                unprioritized, RealtimeWorkerPool::shared().getNumWorkers());
+  return 0;
+}
+
+Result runCase(const Case &c, double seconds, int repeats) {
+  // Best of several runs filters out scheduler noise
+  double best = renderCase(c, seconds);
+  for (int i = 1; i < repeats; ++i)
+    best = std::min(best, renderCase(c, seconds));
+
+  const int samples = static_cast<int>(seconds * c.sampleRate);
+  return {c, best * 1e9 / samples, seconds / best};
+}
+
+void writeCsv(FILE *f, const std::vector<Result> &results) {
+  std::fprintf(f, "sample_rate,block_size,chips,render_mode,notes_per_second,"
+                  "ns_per_sample,realtime_factor\n");
+  for (const auto &r : results)
+    std::fprintf(f, "%.0f,%d,%s,%s,%d,%.3f,%.1f\n", r.c.sampleRate,
+                 r.c.blockSize, r.c.vrc6 ? "2A03+VRC6" : "2A03",
+                 modeName(r.c.mode), r.c.notesPerSecond, r.nsPerSample,
+                 r.realtimeFactor);
+}
+
+void writeJson(FILE *f, const std::vector<Result> &results, double seconds,
+               int repeats) {
+  std::fprintf(f, "{\n  \"seconds_per_case\": %g,\n  \"repeats\": %d,\n",
+               seconds, repeats);
+  std::fprintf(f, "  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto &r = results[i];
+    std::fprintf(f,
+                 "    {\"sample_rate\": %.0f, \"block_size\": %d, "
+                 "\"chips\": \"%s\", \"render_mode\": \"%s\", "
+                 "\"notes_per_second\": %d, \"ns_per_sample\": %.3f, "
+                 "\"realtime_factor\": %.1f}%s\n",
+                 r.c.sampleRate, r.c.blockSize,
+                 r.c.vrc6 ? "2A03+VRC6" : "2A03", modeName(r.c.mode),
+                 r.c.notesPerSecond, r.nsPerSample, r.realtimeFactor,
+                 i + 1 < results.size() ? "," : "");
+  }
+  std::fprintf(f, "  ]\n}\n");
+}
+
+bool writeFile(const std::string &path, const std::vector<Result> &results,
+               bool json, double seconds, int repeats) {
+  FILE *f = std::fopen(path.c_str(), "w");
+  if (!f) {
+    std::fprintf(stderr, "Cannot write %s\n", path.c_str());
+    return false;
+  }
+  if (json)
+    writeJson(f, results, seconds, repeats);
+  else
+    writeCsv(f, results);
+  std::fclose(f);
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  bool quick = false;
+  bool stack = false;
+  double seconds = 1.0;
+  int repeats = 3;
+  std::string csvPath, jsonPath;
+
+  for (int i = 1; i < argc; ++i) {
+    const bool hasValue = i + 1 < argc;
+    if (!std::strcmp(argv[i], "--quick")) {
+      quick = true;
+    } else if (!std::strcmp(argv[i], "--seconds") && hasValue) {
+      seconds = std::max(0.01, std::atof(argv[++i]));
+    } else if (!std::strcmp(argv[i], "--repeats") && hasValue) {
+      repeats = std::max(1, std::atoi(argv[++i]));
+    } else if (!std::strcmp(argv[i], "--csv") && hasValue) {
+      csvPath = argv[++i];
+    } else if (!std::strcmp(argv[i], "--json") && hasValue) {
+      jsonPath = argv[++i];
+    } else if (!std::strcmp(argv[i], "--stack")) {
+      stack = true;
+    } else {
+      std::fprintf(stderr,
+                   "Usage: %s [--quick] [--seconds S] [--repeats N] "
+                   "[--csv FILE] [--json FILE] [--stack]\n",
+                   argv[0]);
+      return 2;
+    }
+  }
+
+  if (stack)
+    return runStackBenchmark(seconds, repeats);
+
+  std::vector<double> sampleRates = {44100, 48000, 88200, 96000, 176400,
+                                     192000};
+  std::vector<int> blockSizes = {32, 64, 128, 256, 512, 1024};
+  std::vector<int> densities = {0, 8, 64, 512};
+  if (quick) {
+    sampleRates = {44100, 192000};
+    blockSizes = {32, 512};
+    densities = {0, 64};
+    seconds = std::min(seconds, 0.25);
+    repeats = 1;
+  }
+  const NessyAPU::RenderMode modes[] = {NessyAPU::RenderMode::SAMPLED,
+                                        NessyAPU::RenderMode::EVENT_DRIVEN,
+                                        NessyAPU::RenderMode::BANDLIMITED};
+
+  std::vector<Result> results;
+  std::printf("%8s %6s %-10s %-13s %6s %12s %10s\n", "rate", "block",
+              "chips", "mode", "notes", "ns/sample", "realtime");
+
+  for (double rate : sampleRates)
+    for (int block : blockSizes)
+      for (bool vrc6 : {false, true})
+        for (auto mode : modes)
+          for (int density : densities) {
+            const Result r =
+                runCase({rate, block, vrc6, mode, density}, seconds, repeats);
+            results.push_back(r);
+            std::printf("%8.0f %6d %-10s %-13s %6d %12.2f %9.0fx\n", rate,
+                        block, vrc6 ? "2A03+VRC6" : "2A03", modeName(mode),
+                        density, r.nsPerSample, r.realtimeFactor);
+            std::fflush(stdout);
+          }
+
+  bool ok = true;
+  if (!csvPath.empty())
+    ok = writeFile(csvPath, results, false, seconds, repeats) && ok;
+  if (!jsonPath.empty())
+    ok = writeFile(jsonPath, results, true, seconds, repeats) && ok;
+  return ok ? 0 : 1;
+}
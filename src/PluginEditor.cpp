@@ -116,6 +116,7 @@ NessyAudioProcessorEditor::NessyAudioProcessorEditor(NessyAudioProcessor &p)
   voiceModeBox.addItem("Round-Robin", 1);
   voiceModeBox.addItem("Pitch-Split", 2);
   voiceModeBox.addItem("Unison", 3);
+  voiceModeBox.addItem("Multitimbral", 4);
   voiceModeBox.setColour(juce::ComboBox::backgroundColourId, kHeaderColor);
   voiceModeBox.setColour(juce::ComboBox::textColourId, kTextColor);
   voiceModeBox.setColour(juce::ComboBox::outlineColourId,
@@ -137,6 +138,16 @@ NessyAudioProcessorEditor::NessyAudioProcessorEditor(NessyAudioProcessor &p)
       std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
           apvts, "splitPoint", splitPointSlider);
 
+  // Chip count slider
+  chipCountSlider.setSliderStyle(juce::Slider::LinearHorizontal);
+  chipCountSlider.setTextBoxStyle(juce::Slider::TextBoxRight, false, 30, 20);
+  chipCountSlider.setColour(juce::Slider::thumbColourId, kTextColor);
+  chipCountSlider.setColour(juce::Slider::trackColourId, kHeaderColor);
+  addAndMakeVisible(chipCountSlider);
+  chipCountAttachment =
+      std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
+          apvts, "chipCount", chipCountSlider);
+
   // Noise mode toggle
   noiseModeToggle.setColour(juce::ToggleButton::tickColourId, kOrangeColor);
   addAndMakeVisible(noiseModeToggle);
@@ -178,6 +189,28 @@ NessyAudioProcessorEditor::NessyAudioProcessorEditor(NessyAudioProcessor &p)
       std::make_unique<juce::AudioProcessorValueTreeState::ComboBoxAttachment>(
           apvts, "vrc6Pulse2Duty", vrc6Pulse2DutyBox);
 
+  // Channel pan sliders, in the columns' colors
+  const char *const panIDs[NUM_PAN_SLIDERS] = {
+      "pulse1Pan",     "pulse2Pan",     "trianglePan", "noisePan",
+      "vrc6Pulse1Pan", "vrc6Pulse2Pan", "vrc6SawPan"};
+  const juce::Colour vrc6Color(0xff9b59b6); // Purple
+  const juce::Colour panColors[NUM_PAN_SLIDERS] = {
+      kPrimaryColor, kSecondaryColor, kAccentColor, kOrangeColor,
+      vrc6Color,     vrc6Color,       vrc6Color};
+  for (int i = 0; i < NUM_PAN_SLIDERS; ++i) {
+    auto &slider = panSliders[i];
+    slider.setSliderStyle(juce::Slider::LinearHorizontal);
+    slider.setTextBoxStyle(juce::Slider::NoTextBox, false, 0, 0);
+    slider.setColour(juce::Slider::thumbColourId, panColors[i]);
+    slider.setColour(juce::Slider::trackColourId, kHeaderColor);
+    slider.setDoubleClickReturnValue(true, 0.0);
+    slider.setTooltip("Pan");
+    addAndMakeVisible(slider);
+    panAttachments[i] =
+        std::make_unique<juce::AudioProcessorValueTreeState::SliderAttachment>(
+            apvts, panIDs[i], slider);
+  }
+
   // Keyboard styling
   keyboard.setKeyWidth(35.0f);
   keyboard.setColour(juce::MidiKeyboardComponent::whiteNoteColourId,
@@ -255,6 +288,10 @@ void NessyAudioProcessorEditor::paint(juce::Graphics &g) {
   g.drawText("VOICE MODE", getWidth() - 110, 15, 100, 14,
              juce::Justification::centred);
 
+  // Chip count label
+  g.drawText("CHIPS", getWidth() - 260, 15, 140, 14,
+             juce::Justification::centred);
+
   // Footer
   g.setColour(kTextColor.withAlpha(0.3f));
   g.setFont(getBodyFont(9.0f));
@@ -271,6 +308,7 @@ void NessyAudioProcessorEditor::resized() {
 
   // Header area controls
   voiceModeBox.setBounds(getWidth() - 110, 30, 100, 22);
+  chipCountSlider.setBounds(getWidth() - 260, 30, 140, 22);
 
   // Split point slider (below voice mode)
   splitPointLabel.setBounds(getWidth() - 180, 55, 40, 20);
@@ -311,6 +349,10 @@ void NessyAudioProcessorEditor::resized() {
                                 channelRect.getY() + 60,
                                 channelRect.getWidth() - 20, 24);
     }
+
+    // Pan
+    panSliders[i].setBounds(channelRect.getX() + 10, channelRect.getY() + 95,
+                            channelRect.getWidth() - 20, 20);
   }
 
   // VRC6 Expansion section (purple separator)
@@ -323,4 +365,9 @@ void NessyAudioProcessorEditor::resized() {
   // VRC6 duty boxes
   vrc6Pulse1DutyBox.setBounds(vrc6X, channelArea.getY() + 60, 75, 24);
   vrc6Pulse2DutyBox.setBounds(vrc6X + 80, channelArea.getY() + 60, 75, 24);
+
+  // VRC6 pans: pulse 1, pulse 2, saw
+  for (int i = 0; i < 3; ++i)
+    panSliders[4 + i].setBounds(vrc6X + i * 53, channelArea.getY() + 95, 48,
+                                20);
 }
@@ -55,6 +55,11 @@ private:
   std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment>
       splitPointAttachment;
 
+  // Chip stack size
+  juce::Slider chipCountSlider;
+  std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment>
+      chipCountAttachment;
+
   // Noise mode toggle
   juce::ToggleButton noiseModeToggle{"Short"};
   std::unique_ptr<juce::AudioProcessorValueTreeState::ButtonAttachment>
@@ -72,5 +77,11 @@ private:
   std::unique_ptr<juce::AudioProcessorValueTreeState::ComboBoxAttachment>
       vrc6Pulse2DutyAttachment;
 
+  // Channel pans: the four base channels, then the three VRC6 channels
+  static constexpr int NUM_PAN_SLIDERS = 7;
+  juce::Slider panSliders[NUM_PAN_SLIDERS];
+  std::unique_ptr<juce::AudioProcessorValueTreeState::SliderAttachment>
+      panAttachments[NUM_PAN_SLIDERS];
+
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(NessyAudioProcessorEditor)
 };
@@ -1,8 +1,31 @@
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "apu/ChipStack.h"
 #include "apu/NessyAPU.h"
 #include "apu/VoiceAllocator.h"
 
+// Parameter IDs in NessyAudioProcessor::EngineParameter order
+static const char *const engineParameterIDs[] = {
+    "pulse1Enable",  "pulse2Enable",  "triangleEnable", "noiseEnable",
+    "pulse1Duty",    "pulse2Duty",    "noiseMode",      "voiceMode",
+    "splitPoint",    "vrc6Enable",    "vrc6Pulse1Duty", "vrc6Pulse2Duty",
+    "chipCount",     "pulse1Pan",     "pulse2Pan",      "trianglePan",
+    "noisePan",      "vrc6Pulse1Pan", "vrc6Pulse2Pan",  "vrc6SawPan",
+    "stemMixer"};
+
+// Per-channel stem output buses, after the main bus in NessyAPU::Channel
+// order
+static const char *const stemBusNames[] = {
+    "Pulse 1", "Pulse 2",      "Triangle",     "Noise",
+    "DMC",     "VRC6 Pulse 1", "VRC6 Pulse 2", "VRC6 Saw"};
+
+// Parameters that feed PeriodTable::Tuning, in tuningValues order
+static const char *const tuningParameterIDs[] = {
+    "tuningA4", "detuneCents", "temperament", "temperamentRoot"};
+
+// How often the message thread checks the tuning parameters
+static constexpr int TUNING_POLL_HZ = 20;
+
 static juce::AudioProcessorValueTreeState::ParameterLayout
 createParameterLayout() {
   juce::AudioProcessorValueTreeState::ParameterLayout layout;
@@ -40,7 +63,8 @@ createParameterLayout() {
   // Voice allocation mode
   layout.add(std::make_unique<juce::AudioParameterChoice>(
       juce::ParameterID("voiceMode", 1), "Voice Mode",
-      juce::StringArray{"Round-Robin", "Pitch-Split", "Unison"},
+      juce::StringArray{"Round-Robin", "Pitch-Split", "Unison",
+                        "Multitimbral"},
       0)); // Default to Round-Robin
 
   // Pitch split point (MIDI note 36-84, default 60 = C4)
@@ -65,20 +89,219 @@ createParameterLayout() {
                         "43.75%", "50%"},
       7));
 
+  // Chip stack: independent chip sets sharing the voices (1 = a single NES)
+  layout.add(std::make_unique<juce::AudioParameterInt>(
+      juce::ParameterID("chipCount", 1), "Chip Count", 1,
+      ChipStack::MAX_CHIPS, 1));
+
+  // Channel pans (-100 = hard left, 0 = centre, 100 = hard right)
+  const std::pair<const char *, const char *> pans[] = {
+      {"pulse1Pan", "Pulse 1 Pan"},
+      {"pulse2Pan", "Pulse 2 Pan"},
+      {"trianglePan", "Triangle Pan"},
+      {"noisePan", "Noise Pan"},
+      {"vrc6Pulse1Pan", "VRC6 Pulse 1 Pan"},
+      {"vrc6Pulse2Pan", "VRC6 Pulse 2 Pan"},
+      {"vrc6SawPan", "VRC6 Saw Pan"}};
+  for (const auto &[id, name] : pans)
+    layout.add(std::make_unique<juce::AudioParameterInt>(
+        juce::ParameterID(id, 1), name, -100, 100, 0));
+
+  // Stem outputs: each channel through the nonlinear DAC alone, or linear
+  layout.add(std::make_unique<juce::AudioParameterChoice>(
+      juce::ParameterID("stemMixer", 1), "Stem Mixer",
+      juce::StringArray{"Nonlinear", "Linear"}, 0));
+
+  // Tuning: A4 reference, global detune and temperament
+  layout.add(std::make_unique<juce::AudioParameterFloat>(
+      juce::ParameterID("tuningA4", 1), "A4 Reference",
+      juce::NormalisableRange<float>(415.0f, 466.0f, 0.1f), 440.0f));
+  layout.add(std::make_unique<juce::AudioParameterFloat>(
+      juce::ParameterID("detuneCents", 1), "Detune",
+      juce::NormalisableRange<float>(-100.0f, 100.0f, 0.1f), 0.0f));
+  layout.add(std::make_unique<juce::AudioParameterChoice>(
+      juce::ParameterID("temperament", 1), "Temperament",
+      juce::StringArray{"Equal", "Just", "Pythagorean", "Meantone",
+                        "Werckmeister III"},
+      0)); // Default to equal temperament
+  layout.add(std::make_unique<juce::AudioParameterChoice>(
+      juce::ParameterID("temperamentRoot", 1), "Temperament Root",
+      juce::StringArray{"C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A",
+                        "A#", "B"},
+      0));
+
   return layout;
 }
 
+static juce::AudioProcessor::BusesProperties createBusesProperties() {
+  auto buses = juce::AudioProcessor::BusesProperties().withOutput(
+      "Output", juce::AudioChannelSet::stereo(), true);
+  for (auto *name : stemBusNames)
+    buses = buses.withOutput(name, juce::AudioChannelSet::mono(), false);
+  return buses;
+}
+
 NessyAudioProcessor::NessyAudioProcessor()
-    : AudioProcessor(BusesProperties().withOutput(
-          "Output", juce::AudioChannelSet::stereo(), true)),
+    : AudioProcessor(createBusesProperties()),
       parameters(*this, nullptr, juce::Identifier("NessyParameters"),
                  createParameterLayout()),
-      apu(std::make_unique<NessyAPU>()),
+      chips(std::make_unique<ChipStack>()),
       voiceAllocator(std::make_unique<VoiceAllocator>()) {
-  voiceAllocator->setAPU(apu.get());
+  voiceAllocator->setAPUs(chips->getChips(), ChipStack::MAX_CHIPS);
+
+  masterVolumeValue = parameters.getRawParameterValue("masterVolume");
+  for (int i = 0; i < NUM_ENGINE_PARAMETERS; ++i)
+    engineValues[i] = parameters.getRawParameterValue(engineParameterIDs[i]);
+  appliedValues.fill(NOT_APPLIED);
+
+  for (size_t i = 0; i < tuningValues.size(); ++i)
+    tuningValues[i] = parameters.getRawParameterValue(tuningParameterIDs[i]);
+  updateTuning();
+  startTimerHz(TUNING_POLL_HZ);
 }
 
-NessyAudioProcessor::~NessyAudioProcessor() {}
+NessyAudioProcessor::~NessyAudioProcessor() { stopTimer(); }
+
+void NessyAudioProcessor::timerCallback() {
+  updateTuning();
+  prepareChipWorkers();
+}
+
+void NessyAudioProcessor::updateTuning() {
+  PeriodTable::Tuning tuning;
+  tuning.referenceA4 = tuningValues[0]->load();
+  tuning.detuneCents = tuningValues[1]->load();
+  tuning.temperament = static_cast<PeriodTable::Temperament>(
+      static_cast<int>(tuningValues[2]->load()));
+  tuning.root = static_cast<int>(tuningValues[3]->load());
+
+  // setTuning() returns early while the tuning is unchanged
+  chips->forEachChip([&tuning](NessyAPU &apu) { apu.setTuning(tuning); });
+}
+
+void NessyAudioProcessor::prepareChipWorkers() {
+  // Returns early once the workers are running
+  chips->prepareWorkers(juce::roundToInt(engineValues[CHIP_COUNT]->load()));
+}
+
+void NessyAudioProcessor::applyEngineParameters() {
+  for (int i = 0; i < NUM_ENGINE_PARAMETERS; ++i) {
+    const int value = juce::roundToInt(engineValues[i]->load());
+    if (value != appliedValues[i]) {
+      appliedValues[i] = value;
+      applyEngineParameter(static_cast<EngineParameter>(i), value);
+    }
+  }
+}
+
+void NessyAudioProcessor::applyEngineParameter(EngineParameter parameter,
+                                               int value) {
+  switch (parameter) {
+  case VOICE_MODE:
+    voiceAllocator->setMode(static_cast<VoiceAllocator::Mode>(value));
+    return;
+  case SPLIT_POINT:
+    voiceAllocator->setSplitPoint(value);
+    return;
+  case VRC6_ENABLE:
+    voiceAllocator->setVRC6Enabled(value != 0);
+    break;
+  case CHIP_COUNT:
+    voiceAllocator->setNumChips(value);
+    chips->setNumChips(value);
+    return;
+  case PULSE1_ENABLE:
+  case PULSE2_ENABLE:
+  case TRIANGLE_ENABLE:
+  case NOISE_ENABLE:
+  case PULSE1_DUTY:
+  case PULSE2_DUTY:
+  case NOISE_MODE:
+  case VRC6_PULSE1_DUTY:
+  case VRC6_PULSE2_DUTY:
+  case PULSE1_PAN:
+  case PULSE2_PAN:
+  case TRIANGLE_PAN:
+  case NOISE_PAN:
+  case VRC6_PULSE1_PAN:
+  case VRC6_PULSE2_PAN:
+  case VRC6_SAW_PAN:
+  case STEM_MIXER:
+  case NUM_ENGINE_PARAMETERS:
+    break;
+  }
+
+  // Inactive chips are configured too, so they are ready when added
+  chips->forEachChip([parameter, value](NessyAPU &apu) {
+    applyChipParameter(apu, parameter, value);
+  });
+}
+
+void NessyAudioProcessor::applyChipParameter(NessyAPU &apu,
+                                             EngineParameter parameter,
+                                             int value) {
+  switch (parameter) {
+  case PULSE1_ENABLE:
+    apu.setChannelEnabled(NessyAPU::PULSE1, value != 0);
+    break;
+  case PULSE2_ENABLE:
+    apu.setChannelEnabled(NessyAPU::PULSE2, value != 0);
+    break;
+  case TRIANGLE_ENABLE:
+    apu.setChannelEnabled(NessyAPU::TRIANGLE, value != 0);
+    break;
+  case NOISE_ENABLE:
+    apu.setChannelEnabled(NessyAPU::NOISE, value != 0);
+    break;
+  case PULSE1_DUTY:
+    apu.setPulseDuty(0, static_cast<NessyAPU::DutyCycle>(value));
+    break;
+  case PULSE2_DUTY:
+    apu.setPulseDuty(1, static_cast<NessyAPU::DutyCycle>(value));
+    break;
+  case NOISE_MODE:
+    apu.setNoiseMode(value != 0);
+    break;
+  case VRC6_ENABLE:
+    apu.setVRC6Enabled(value != 0);
+    break;
+  case VRC6_PULSE1_DUTY:
+    apu.setVRC6PulseDuty(0, value);
+    break;
+  case VRC6_PULSE2_DUTY:
+    apu.setVRC6PulseDuty(1, value);
+    break;
+  case PULSE1_PAN:
+    apu.setChannelPan(NessyAPU::PULSE1, value / 100.0f);
+    break;
+  case PULSE2_PAN:
+    apu.setChannelPan(NessyAPU::PULSE2, value / 100.0f);
+    break;
+  case TRIANGLE_PAN:
+    apu.setChannelPan(NessyAPU::TRIANGLE, value / 100.0f);
+    break;
+  case NOISE_PAN:
+    apu.setChannelPan(NessyAPU::NOISE, value / 100.0f);
+    break;
+  case VRC6_PULSE1_PAN:
+    apu.setChannelPan(NessyAPU::VRC6_PULSE1, value / 100.0f);
+    break;
+  case VRC6_PULSE2_PAN:
+    apu.setChannelPan(NessyAPU::VRC6_PULSE2, value / 100.0f);
+    break;
+  case VRC6_SAW_PAN:
+    apu.setChannelPan(NessyAPU::VRC6_SAW, value / 100.0f);
+    break;
+  case STEM_MIXER:
+    apu.setStemNonlinear(value == 0);
+    break;
+  case VOICE_MODE:
+  case SPLIT_POINT:
+  case CHIP_COUNT:
+  case NUM_ENGINE_PARAMETERS:
+    break;
+  }
+}
 
 const juce::String NessyAudioProcessor::getName() const {
   return JucePlugin_Name;
@@ -99,40 +322,56 @@ void NessyAudioProcessor::prepareToPlay(double sampleRate,
                                         int /*samplesPerBlock*/) {
   currentSampleRate = sampleRate;
 
-  // Initialize APU with host sample rate
-  apu->initialize(sampleRate);
+  // Stems are rendered only while some stem bus is enabled; the layout only
+  // changes with the processor stopped
+  const bool stems = hasStemOutputs();
+  chips->forEachChip([stems](NessyAPU &apu) { apu.setStemsEnabled(stems); });
 
-  // Apply initial channel settings from parameters
-  apu->setChannelEnabled(
-      NessyAPU::PULSE1,
-      parameters.getRawParameterValue("pulse1Enable")->load() > 0.5f);
-  apu->setChannelEnabled(
-      NessyAPU::PULSE2,
-      parameters.getRawParameterValue("pulse2Enable")->load() > 0.5f);
-  apu->setChannelEnabled(
-      NessyAPU::TRIANGLE,
-      parameters.getRawParameterValue("triangleEnable")->load() > 0.5f);
-  apu->setChannelEnabled(
-      NessyAPU::NOISE,
-      parameters.getRawParameterValue("noiseEnable")->load() > 0.5f);
+  // Initialize every chip with host sample rate
+  chips->initialize(sampleRate);
 
-  // VRC6 expansion
-  apu->setVRC6Enabled(parameters.getRawParameterValue("vrc6Enable")->load() >
-                      0.5f);
+  // Workers for the current chip count start here; later changes get
+  // theirs from the timer
+  prepareChipWorkers();
+
+  // initialize() resets the chips, so reapply every parameter
+  appliedValues.fill(NOT_APPLIED);
+  applyEngineParameters();
+
+  // Start at the current master volume rather than ramping to it
+  const float masterVolume = masterVolumeValue->load();
+  chips->forEachChip([masterVolume](NessyAPU &apu) {
+    apu.setOutputGain(masterVolume, false);
+  });
 }
 
 void NessyAudioProcessor::releaseResources() {
   voiceAllocator->allNotesOff();
-  apu->reset();
+  chips->reset();
+  appliedValues.fill(NOT_APPLIED);
 }
 
 bool NessyAudioProcessor::isBusesLayoutSupported(
     const BusesLayout &layouts) const {
   if (layouts.getMainOutputChannelSet() != juce::AudioChannelSet::stereo())
     return false;
+
+  // Stem buses are mono, each on or off
+  for (int i = 1; i < layouts.outputBuses.size(); ++i) {
+    const auto &set = layouts.outputBuses.getReference(i);
+    if (!set.isDisabled() && set != juce::AudioChannelSet::mono())
+      return false;
+  }
   return true;
 }
 
+bool NessyAudioProcessor::hasStemOutputs() const {
+  for (int i = 1; i < getBusCount(false); ++i)
+    if (getBus(false, i)->isEnabled())
+      return true;
+  return false;
+}
+
 void NessyAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
                                        juce::MidiBuffer &midiMessages) {
   juce::ScopedNoDenormals noDenormals;
@@ -141,44 +380,27 @@ void NessyAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
   auto *leftChannel = buffer.getWritePointer(0);
   auto *rightChannel = buffer.getWritePointer(1);
 
-  // Get master volume
-  float masterVolume = parameters.getRawParameterValue("masterVolume")->load();
-
-  // Update duty cycles from parameters
-  int pulse1Duty =
-      static_cast<int>(parameters.getRawParameterValue("pulse1Duty")->load());
-  int pulse2Duty =
-      static_cast<int>(parameters.getRawParameterValue("pulse2Duty")->load());
-  apu->setPulseDuty(0, static_cast<NessyAPU::DutyCycle>(pulse1Duty));
-  apu->setPulseDuty(1, static_cast<NessyAPU::DutyCycle>(pulse2Duty));
-
-  // Update noise mode
-  bool noiseMode = parameters.getRawParameterValue("noiseMode")->load() > 0.5f;
-  apu->setNoiseMode(noiseMode);
-
-  // Update voice allocation mode
-  int voiceMode =
-      static_cast<int>(parameters.getRawParameterValue("voiceMode")->load());
-  voiceAllocator->setMode(static_cast<VoiceAllocator::Mode>(voiceMode));
-
-  // Update pitch split point
-  int splitPoint =
-      static_cast<int>(parameters.getRawParameterValue("splitPoint")->load());
-  voiceAllocator->setSplitPoint(splitPoint);
-
-  // Sync VRC6 enable state to voice allocator
-  bool vrc6Enabled =
-      parameters.getRawParameterValue("vrc6Enable")->load() > 0.5f;
-  voiceAllocator->setVRC6Enabled(vrc6Enabled);
-  apu->setVRC6Enabled(vrc6Enabled);
+  // Turn parameter changes since the last block into chip writes
+  applyEngineParameters();
+
+  // The chips apply master volume as they convert to float, ramping to a
+  // new value over a few milliseconds
+  const float masterVolume = masterVolumeValue->load();
+  chips->forEachChip(
+      [masterVolume](NessyAPU &apu) { apu.setOutputGain(masterVolume); });
 
   // Add virtual keyboard events to the MIDI buffer
   keyboardState.processNextMidiBuffer(midiMessages, 0, numSamples, true);
 
-  // Process MIDI messages through voice allocator
+  // Process MIDI messages through voice allocator. Each event's register
+  // writes are queued at its sample offset, and the chips apply them at
+  // that CPU clock while rendering the whole block in one pass.
   for (const auto metadata : midiMessages) {
     auto message = metadata.getMessage();
 
+    chips->setEventOffset(
+        juce::jlimit(0, numSamples, metadata.samplePosition));
+
     if (message.isNoteOn()) {
       voiceAllocator->noteOn(message.getChannel() - 1, message.getNoteNumber(),
                              message.getFloatVelocity());
@@ -190,14 +412,19 @@ void NessyAudioProcessor::processBlock(juce::AudioBuffer<float> &buffer,
     }
   }
 
-  // Generate audio from APU
-  apu->process(leftChannel, rightChannel, numSamples);
-
-  // Apply master volume
-  for (int i = 0; i < numSamples; ++i) {
-    leftChannel[i] *= masterVolume;
-    rightChannel[i] *= masterVolume;
+  // Stem buses follow the main bus in channel order
+  std::array<float *, NessyAPU::NUM_CHANNELS> stemOutputs{};
+  bool anyStems = false;
+  for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c) {
+    if (getBus(false, 1 + c)->isEnabled()) {
+      stemOutputs[c] = getBusBuffer(buffer, false, 1 + c).getWritePointer(0);
+      anyStems = true;
+    }
   }
+
+  // Generate the block from the APU, stems in the same pass
+  chips->process(leftChannel, rightChannel,
+                 anyStems ? stemOutputs.data() : nullptr, numSamples);
 }
 
 juce::AudioProcessorEditor *NessyAudioProcessor::createEditor() {
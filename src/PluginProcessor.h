@@ -2,12 +2,17 @@
 
 #include <juce_audio_processors/juce_audio_processors.h>
 #include <juce_audio_utils/juce_audio_utils.h>
+#include <array>
+#include <atomic>
+#include <limits>
 #include <memory>
 
+class ChipStack;
 class NessyAPU;
 class VoiceAllocator;
 
-class NessyAudioProcessor : public juce::AudioProcessor {
+class NessyAudioProcessor : public juce::AudioProcessor,
+                            private juce::Timer {
 public:
   NessyAudioProcessor();
   ~NessyAudioProcessor() override;
@@ -45,11 +50,53 @@ public:
   juce::AudioProcessorValueTreeState &getAPVTS() { return parameters; }
 
 private:
+  // Tuning parameters rebuild the period tables on the message thread. The
+  // timer polls them, since listeners can be called on the audio thread,
+  // and starts the chip stack workers the chip count needs.
+  void timerCallback() override;
+  void updateTuning();
+  void prepareChipWorkers();
+
+  // Parameters that turn into APU and voice allocator calls
+  enum EngineParameter {
+    PULSE1_ENABLE = 0,
+    PULSE2_ENABLE,
+    TRIANGLE_ENABLE,
+    NOISE_ENABLE,
+    PULSE1_DUTY,
+    PULSE2_DUTY,
+    NOISE_MODE,
+    VOICE_MODE,
+    SPLIT_POINT,
+    VRC6_ENABLE,
+    VRC6_PULSE1_DUTY,
+    VRC6_PULSE2_DUTY,
+    CHIP_COUNT,
+    PULSE1_PAN,
+    PULSE2_PAN,
+    TRIANGLE_PAN,
+    NOISE_PAN,
+    VRC6_PULSE1_PAN,
+    VRC6_PULSE2_PAN,
+    VRC6_SAW_PAN,
+    STEM_MIXER,
+    NUM_ENGINE_PARAMETERS
+  };
+
+  // Applies the engine parameters that changed since they were last applied
+  void applyEngineParameters();
+  void applyEngineParameter(EngineParameter parameter, int value);
+  static void applyChipParameter(NessyAPU &apu, EngineParameter parameter,
+                                 int value);
+
+  // Whether any per-channel stem output bus is enabled
+  bool hasStemOutputs() const;
+
   // Audio parameters
   juce::AudioProcessorValueTreeState parameters;
 
-  // NES APU emulation
-  std::unique_ptr<NessyAPU> apu;
+  // NES APU emulation, one or more chips
+  std::unique_ptr<ChipStack> chips;
 
   // Voice allocator
   std::unique_ptr<VoiceAllocator> voiceAllocator;
@@ -60,5 +107,15 @@ private:
   // Current sample rate
   double currentSampleRate = 44100.0;
 
+  // Parameter values, looked up once at construction
+  std::atomic<float> *masterVolumeValue = nullptr;
+  std::array<std::atomic<float> *, NUM_ENGINE_PARAMETERS> engineValues{};
+  std::array<std::atomic<float> *, 4> tuningValues{};
+
+  // Engine parameter values as last applied. NOT_APPLIED, which no
+  // parameter can take (pans go negative), applies on the next block.
+  static constexpr int NOT_APPLIED = std::numeric_limits<int>::min();
+  std::array<int, NUM_ENGINE_PARAMETERS> appliedValues{};
+
   JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(NessyAudioProcessor)
 };
@@ -0,0 +1,129 @@
+#pragma once
+
+// ChipSet: Compile-time composition of NSFPlay sound chips
+// GPL-3.0 - Uses NSFPlay cores from Dn-FamiTracker
+
+#include "nsfplay/xgm/devices/Sound/nes_apu.h"
+#include "nsfplay/xgm/devices/Sound/nes_dmc.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <tuple>
+#include <type_traits>
+
+// The 2A03 core options a ChipSet fixes at compile time: the nonlinear
+// mixers, DPCM anti-click and the ultrasonic triangle mute. configure()
+// applies them to the cores, which must also be left unmasked.
+template <bool NONLINEAR, bool ANTI_CLICK, bool TRI_MUTE> struct CoreOptions {
+  static constexpr bool nonlinear = NONLINEAR;
+  static constexpr bool antiClick = ANTI_CLICK;
+  static constexpr bool triMute = TRI_MUTE;
+
+  static void configure(xgm::NES_APU &apu, xgm::NES_DMC &dmc) {
+    apu.SetOption(xgm::NES_APU::OPT_NONLINEAR_MIXER, NONLINEAR);
+    dmc.SetOption(xgm::NES_DMC::OPT_NONLINEAR_MIXER, NONLINEAR);
+    dmc.SetOption(xgm::NES_DMC::OPT_DPCM_ANTI_CLICK, ANTI_CLICK);
+    dmc.SetOption(xgm::NES_DMC::OPT_TRI_MUTE, TRI_MUTE);
+  }
+};
+
+// Binds a fixed list of chips and runs the tick and mix steps on each of
+// them through qualified calls. This bypasses the IDevice/ISoundChip vtables,
+// so the compiler (and LTO across the core translation units) sees one
+// statically known sequence of calls. The tick and mix steps of the 2A03
+// cores call the kernels for Options directly rather than through the cores'
+// kernel pointers. The NES_DMC in the list, if any, drives the frame
+// sequencer.
+//
+// Usage: ChipSet<Options, xgm::NES_APU, xgm::NES_DMC> chips(apu, dmc);
+template <typename Options, typename... Chips> class ChipSet {
+public:
+  static constexpr bool hasFrameSequencer =
+      (std::is_same_v<Chips, xgm::NES_DMC> || ...);
+
+  explicit ChipSet(Chips &...chips) : m_chips(chips...) {}
+
+  // Advance every chip, frame sequencer first
+  void tick(uint32_t cpuClocks) {
+    tickFrameSequence(cpuClocks);
+    tickChips(cpuClocks);
+  }
+
+  // Advance every chip without the frame sequencer
+  void tickChips(uint32_t cpuClocks) {
+    forEach([cpuClocks](auto &chip) {
+      using Chip = std::remove_reference_t<decltype(chip)>;
+      if constexpr (std::is_same_v<Chip, xgm::NES_DMC>)
+        chip.template TickWith<Options::triMute>(cpuClocks);
+      else
+        chip.Chip::Tick(cpuClocks);
+    });
+  }
+
+  // Sum of the chips' current left and right outputs
+  void mixLevels(int32_t levels[2]) {
+    levels[0] = levels[1] = 0;
+    forEach([levels](auto &chip) {
+      using Chip = std::remove_reference_t<decltype(chip)>;
+      int32_t out[2] = {0, 0};
+      if constexpr (std::is_same_v<Chip, xgm::NES_APU>)
+        chip.template RenderWith<Options::nonlinear>(out);
+      else if constexpr (std::is_same_v<Chip, xgm::NES_DMC>)
+        chip.template RenderWith<Options::nonlinear, Options::antiClick>(out);
+      else
+        chip.Chip::Render(out);
+      levels[0] += out[0];
+      levels[1] += out[1];
+    });
+  }
+
+  // Every chip's channels on their own, one level per channel in chip
+  // order (see RenderChannels()); returns the number of channels
+  int mixChannels(int32_t *levels, bool nonlinear) {
+    int count = 0;
+    forEach([levels, nonlinear, &count](auto &chip) {
+      using Chip = std::remove_reference_t<decltype(chip)>;
+      count += static_cast<int>(
+          chip.Chip::RenderChannels(levels + count, nonlinear));
+    });
+    return count;
+  }
+
+  // Clocks until any chip's output level can change
+  uint32_t clocksUntilLevelChange() {
+    uint32_t clocks = UINT32_MAX;
+    forEach([&clocks](auto &chip) {
+      using Chip = std::remove_reference_t<decltype(chip)>;
+      clocks = std::min<uint32_t>(clocks, chip.Chip::ClocksUntilLevelChange());
+    });
+    return clocks;
+  }
+
+  // Tick and mix a run of frames into an interleaved stereo buffer. The run
+  // must not cross a frame sequencer step (see clocksUntilFrameSequence()).
+  void renderBlock(int32_t *mix, uint32_t frames, const uint32_t *clocks) {
+    forEach([=](auto &chip) {
+      using Chip = std::remove_reference_t<decltype(chip)>;
+      chip.Chip::RenderBlock(mix, frames, clocks);
+    });
+  }
+
+  void tickFrameSequence(uint32_t cpuClocks) {
+    if constexpr (hasFrameSequencer)
+      std::get<xgm::NES_DMC &>(m_chips).TickFrameSequence(cpuClocks);
+  }
+
+  uint32_t clocksUntilFrameSequence() const {
+    if constexpr (hasFrameSequencer)
+      return std::get<xgm::NES_DMC &>(m_chips).ClocksUntilFrameSequence();
+    else
+      return UINT32_MAX;
+  }
+
+private:
+  template <typename F> void forEach(F &&f) {
+    std::apply([&f](auto &...chip) { (f(chip), ...); }, m_chips);
+  }
+
+  std::tuple<Chips &...> m_chips;
+};
@@ -0,0 +1,156 @@
+// ChipStack: Several independent NES chip sets played as one instrument
+// GPL-3.0
+
+#include "ChipStack.h"
+
+#include <algorithm>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NESSY_SUM_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NESSY_SUM_NEON 1
+#endif
+
+static int defaultWorkerCount() {
+  const int spare = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+  return std::clamp(spare, 0, ChipStack::MAX_CHIPS - 1);
+}
+
+ChipStack::ChipStack(int numWorkers)
+    : m_scratch(static_cast<size_t>(MAX_CHIPS) * SCRATCH_CHANNELS *
+                SCRATCH_SIZE),
+      m_maxWorkers(numWorkers < 0 ? defaultWorkerCount()
+                                  : std::min(numWorkers, MAX_CHIPS - 1)) {
+  for (int i = 0; i < MAX_CHIPS; ++i) {
+    m_chips[i] = std::make_unique<NessyAPU>();
+    m_chipPointers[i] = m_chips[i].get();
+  }
+  if (m_maxWorkers > 0)
+    m_pool = &RealtimeWorkerPool::shared();
+}
+
+void ChipStack::initialize(double sampleRate) {
+  for (auto &chip : m_chips)
+    chip->initialize(sampleRate);
+}
+
+void ChipStack::reset() {
+  for (auto &chip : m_chips)
+    chip->reset();
+}
+
+void ChipStack::prepareWorkers(int numChips) {
+  numChips = std::clamp(numChips, 1, MAX_CHIPS);
+  if (m_pool != nullptr && numChips >= PARALLEL_MIN_CHIPS)
+    m_pool->reserveWorkers(std::min(m_maxWorkers, numChips - 1));
+}
+
+void ChipStack::setNumChips(int numChips) {
+  m_numChips = std::clamp(numChips, 1, MAX_CHIPS);
+}
+
+int ChipStack::getNumWorkers() const {
+  if (m_pool == nullptr || m_numChips < PARALLEL_MIN_CHIPS)
+    return 0;
+  return std::min({m_pool->getNumWorkers(), m_maxWorkers, m_numChips - 1});
+}
+
+void ChipStack::setEventOffset(int sampleOffset) {
+  for (int i = 0; i < m_numChips; ++i)
+    m_chips[i]->setEventOffset(sampleOffset);
+}
+
+int ChipStack::process(float *leftOutput, float *rightOutput,
+                       int numSamples) {
+  return process(leftOutput, rightOutput, nullptr, numSamples);
+}
+
+int ChipStack::process(float *leftOutput, float *rightOutput,
+                       float *const stemOutputs[NessyAPU::NUM_CHANNELS],
+                       int numSamples) {
+  if (m_numChips == 1)
+    return m_chips[0]->process(leftOutput, rightOutput, stemOutputs,
+                               numSamples);
+
+  m_chunkHasStems = stemOutputs != nullptr;
+  for (int offset = 0; offset < numSamples; offset += SCRATCH_SIZE) {
+    m_chunkLeft = leftOutput + offset;
+    m_chunkRight = rightOutput + offset;
+    for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+      m_chunkStems[c] = m_chunkHasStems && stemOutputs[c] != nullptr
+                            ? stemOutputs[c] + offset
+                            : nullptr;
+    m_chunkSamples = std::min(SCRATCH_SIZE, numSamples - offset);
+
+    if (m_pool != nullptr && m_numChips >= PARALLEL_MIN_CHIPS)
+      m_pool->run(&ChipStack::renderChip, this, m_numChips);
+    else
+      for (int i = 0; i < m_numChips; ++i)
+        renderChip(this, i);
+
+    sumInto(m_chunkLeft, 0, m_chunkSamples);
+    sumInto(m_chunkRight, 1, m_chunkSamples);
+    for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+      if (m_chunkStems[c] != nullptr)
+        sumInto(m_chunkStems[c], 2 + c, m_chunkSamples);
+  }
+  return numSamples;
+}
+
+void ChipStack::renderChip(void *context, int index) {
+  auto &stack = *static_cast<ChipStack *>(context);
+  if (index == 0) {
+    stack.m_chips[0]->process(stack.m_chunkLeft, stack.m_chunkRight,
+                              stack.m_chunkHasStems ? stack.m_chunkStems
+                                                    : nullptr,
+                              stack.m_chunkSamples);
+    return;
+  }
+
+  float *scratch =
+      stack.m_scratch.data() + index * SCRATCH_CHANNELS * SCRATCH_SIZE;
+  float *stems[NessyAPU::NUM_CHANNELS];
+  for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+    stems[c] = stack.m_chunkStems[c] != nullptr
+                   ? scratch + (2 + c) * SCRATCH_SIZE
+                   : nullptr;
+  stack.m_chips[index]->process(scratch, scratch + SCRATCH_SIZE,
+                                stack.m_chunkHasStems ? stems : nullptr,
+                                stack.m_chunkSamples);
+}
+
+void ChipStack::sumInto(float *output, int channel, int numSamples) const {
+  const float *scratch[MAX_CHIPS];
+  const int numSources = m_numChips - 1;
+  for (int c = 0; c < numSources; ++c)
+    scratch[c] = m_scratch.data() +
+                 ((c + 1) * SCRATCH_CHANNELS + channel) * SCRATCH_SIZE;
+
+  // One pass over the output, adding every chip per vector of samples
+  int i = 0;
+#if NESSY_SUM_SSE2
+  for (; i + 4 <= numSamples; i += 4) {
+    __m128 sum = _mm_loadu_ps(output + i);
+    for (int c = 0; c < numSources; ++c)
+      sum = _mm_add_ps(sum, _mm_loadu_ps(scratch[c] + i));
+    _mm_storeu_ps(output + i, sum);
+  }
+#elif NESSY_SUM_NEON
+  for (; i + 4 <= numSamples; i += 4) {
+    float32x4_t sum = vld1q_f32(output + i);
+    for (int c = 0; c < numSources; ++c)
+      sum = vaddq_f32(sum, vld1q_f32(scratch[c] + i));
+    vst1q_f32(output + i, sum);
+  }
+#endif
+  for (; i < numSamples; ++i) {
+    float sum = output[i];
+    for (int c = 0; c < numSources; ++c)
+      sum += scratch[c][i];
+    output[i] = sum;
+  }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+// ChipStack: Several independent NES chip sets played as one instrument
+// GPL-3.0
+
+#include "NessyAPU.h"
+#include "RealtimeWorkerPool.h"
+#include "VoiceAllocator.h"
+
+#include <array>
+#include <memory>
+#include <vector>
+
+// Owns MAX_CHIPS NessyAPU instances, each a full 2A03 (plus VRC6 when
+// enabled), of which the first getNumChips() are active. Every instance is
+// configured alike; VoiceAllocator spreads notes across the active ones.
+// Active chips render into their own buffers and are summed at unity gain,
+// so a single note is as loud as on one chip. With enough active chips the
+// chips render concurrently on the shared RealtimeWorkerPool.
+class ChipStack {
+public:
+  static constexpr int MAX_CHIPS = VoiceAllocator::MAX_CHIPS;
+
+  // Fewest active chips that render on the worker pool; below this the
+  // wake-up costs more than the chips take to render
+  static constexpr int PARALLEL_MIN_CHIPS = 4;
+
+  // The most workers this stack starts in the shared pool: numWorkers < 0 =
+  // one per spare hardware thread, and never more than MAX_CHIPS - 1. None
+  // start until prepareWorkers() asks for PARALLEL_MIN_CHIPS or more.
+  explicit ChipStack(int numWorkers = -1);
+
+  // Calls initialize() on every chip
+  void initialize(double sampleRate);
+  void reset();
+
+  // Starts the workers numChips active chips render on, up to numChips - 1,
+  // if they are not running yet. Starting threads is not realtime-safe, so
+  // call this off the audio thread (prepareToPlay(), a timer) before
+  // setNumChips() gets there; until then the chips render serially.
+  void prepareWorkers(int numChips);
+
+  // Active chip count, 1 to MAX_CHIPS. Realtime-safe: it only picks which
+  // chips render, on whatever workers prepareWorkers() has started.
+  void setNumChips(int numChips);
+  int getNumChips() const { return m_numChips; }
+
+  NessyAPU &getChip(int index) { return *m_chips[index]; }
+  const NessyAPU &getChip(int index) const { return *m_chips[index]; }
+
+  // Every chip, active or not, for VoiceAllocator::setAPUs()
+  NessyAPU *const *getChips() const { return m_chipPointers.data(); }
+
+  // Applies a configuration call to every chip, active or not, so a chip
+  // sounds like the others when it becomes active
+  template <typename F> void forEachChip(F &&f) {
+    for (auto &chip : m_chips)
+      f(*chip);
+  }
+
+  // Workers the active chips render on, 0 below PARALLEL_MIN_CHIPS
+  int getNumWorkers() const;
+
+  // NessyAPU::setEventOffset() on the active chips, which are the ones
+  // whose next process() call consumes the queued writes
+  void setEventOffset(int sampleOffset);
+
+  // Generate the summed audio of the active chips
+  int process(float *leftOutput, float *rightOutput, int numSamples);
+
+  // The same with the active chips' per-channel stems summed into
+  // stemOutputs (see NessyAPU::setStemsEnabled()); null entries are skipped
+  int process(float *leftOutput, float *rightOutput,
+              float *const stemOutputs[NessyAPU::NUM_CHANNELS],
+              int numSamples);
+
+private:
+  static void renderChip(void *context, int index);
+
+  // Adds the other active chips' scratch buffers onto chip 0's output
+  void sumInto(float *output, int channel, int numSamples) const;
+
+  // Scratch channels per chip: left, right, then the stems
+  static constexpr int SCRATCH_CHANNELS = 2 + NessyAPU::NUM_CHANNELS;
+
+  std::array<std::unique_ptr<NessyAPU>, MAX_CHIPS> m_chips;
+  std::array<NessyAPU *, MAX_CHIPS> m_chipPointers{};
+  int m_numChips = 1;
+
+  // Per-chip scratch; chip 0 renders straight into the output
+  static constexpr int SCRATCH_SIZE = 1024;
+  std::vector<float> m_scratch;
+
+  // The chunk being rendered, read by renderChip(). Stem entries are null
+  // when stems are not being rendered.
+  float *m_chunkLeft = nullptr;
+  float *m_chunkRight = nullptr;
+  float *m_chunkStems[NessyAPU::NUM_CHANNELS] = {};
+  bool m_chunkHasStems = false;
+  int m_chunkSamples = 0;
+
+  int m_maxWorkers = 0;
+
+  // The shared pool, unless this stack renders without workers
+  RealtimeWorkerPool *m_pool = nullptr;
+};
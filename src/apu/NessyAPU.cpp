@@ -2,6 +2,7 @@
 // GPL-3.0 - Uses NSFPlay cores from Dn-FamiTracker
 
 #include "NessyAPU.h"
+#include "ChipSet.h"
 #include "blip_buffer/Blip_Buffer.h"
 #include "nsfplay/xgm/devices/Sound/nes_apu.h"
 #include "nsfplay/xgm/devices/Sound/nes_dmc.h"
@@ -9,19 +10,76 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <type_traits>
 
 // NES frequency lookup table constants
 static constexpr double NES_CPU_CLOCK_NTSC = 1789772.7;
 
-// MIDI note 69 = A4 = 440Hz
-static constexpr int MIDI_A4 = 69;
-static constexpr double FREQ_A4 = 440.0;
+// The 2A03 core options, which are the cores' defaults, and the chip
+// configurations process() can run with
+using CoreConfig = CoreOptions<true, false, true>;
+using ChipSet2A03 = ChipSet<CoreConfig, xgm::NES_APU, xgm::NES_DMC>;
+using ChipSetVRC6 =
+    ChipSet<CoreConfig, xgm::NES_APU, xgm::NES_DMC, xgm::NES_VRC6>;
+
+// Which 2A03 core decodes each register from $4000 to $4017. Writes go only
+// to their owner instead of being offered to both cores, and writes no core
+// decodes ($4014 OAM DMA, $4016 controller) are dropped.
+enum class RegisterOwner : uint8_t { NONE, APU1, APU2, BOTH };
+
+static constexpr uint16_t REGISTER_BASE = 0x4000;
+static constexpr uint16_t REGISTER_COUNT = 0x18;
+
+static constexpr RegisterOwner REGISTER_OWNERS[REGISTER_COUNT] = {
+    // $4000-$4007: pulses
+    RegisterOwner::APU1, RegisterOwner::APU1, RegisterOwner::APU1,
+    RegisterOwner::APU1, RegisterOwner::APU1, RegisterOwner::APU1,
+    RegisterOwner::APU1, RegisterOwner::APU1,
+    // $4008-$4013: triangle, noise, DMC
+    RegisterOwner::APU2, RegisterOwner::APU2, RegisterOwner::APU2,
+    RegisterOwner::APU2, RegisterOwner::APU2, RegisterOwner::APU2,
+    RegisterOwner::APU2, RegisterOwner::APU2, RegisterOwner::APU2,
+    RegisterOwner::APU2, RegisterOwner::APU2, RegisterOwner::APU2,
+    // $4014-$4017: OAM DMA, status, controller, frame counter
+    RegisterOwner::NONE, RegisterOwner::BOTH, RegisterOwner::NONE,
+    RegisterOwner::APU2};
+
+static RegisterOwner registerOwner(uint16_t address) {
+  const uint16_t index = static_cast<uint16_t>(address - REGISTER_BASE);
+  return index < REGISTER_COUNT ? REGISTER_OWNERS[index] : RegisterOwner::NONE;
+}
+
+// Full scale of a mixed chip level, and of Blip_Buffer's output
+static constexpr float LEVEL_SCALE = 1.0f / 8192.0f;
+static constexpr float BLIP_SCALE = 1.0f / 32768.0f;
+
+// Per-channel stem state, allocated by setStemsEnabled()
+struct NessyAPU::Stems {
+  int32_t level[NUM_CHANNELS] = {}; // Levels since the last change
+  std::unique_ptr<Blip_Buffer> blipBuffers[NUM_CHANNELS];
+  std::unique_ptr<Blip_Synth<BLIP_QUALITY>> blipSynths[NUM_CHANNELS];
+  OutputStage output[NUM_CHANNELS];
+  int32_t mixBuffer[NUM_CHANNELS][TEMP_BUFFER_SIZE]; // Levels per sample
+  int16_t tempBuffer[NUM_CHANNELS][TEMP_BUFFER_SIZE]; // Blip_Buffer output
+};
 
 NessyAPU::NessyAPU() {
   m_apu1 = std::make_unique<xgm::NES_APU>();
   m_apu2 = std::make_unique<xgm::NES_DMC>();
   m_vrc6 = std::make_unique<xgm::NES_VRC6>();
-  m_blipBuffer = std::make_unique<Blip_Buffer>();
+  for (int c = 0; c < 2; ++c) {
+    m_blipBuffers[c] = std::make_unique<Blip_Buffer>();
+    m_blipSynths[c] = std::make_unique<Blip_Synth<BLIP_QUALITY>>();
+
+    // Full scale (a mixed level of 8192) reads back as 32768, matching the
+    // level-to-float scaling of the other render modes
+    m_blipSynths[c]->volume(1.0, 16384);
+  }
+
+  selectRenderer();
+  setTuning(PeriodTable::Tuning());
+  loadPeriodTable();
 }
 
 NessyAPU::~NessyAPU() = default;
@@ -33,8 +91,18 @@ void NessyAPU::initialize(double sampleRate) {
   m_clockAccumulator = 0.0;
 
   // Configure Blip_Buffer
-  m_blipBuffer->clock_rate(static_cast<long>(m_clockRate));
-  m_blipBuffer->set_sample_rate(static_cast<long>(m_sampleRate));
+  for (auto &buffer : m_blipBuffers) {
+    buffer->clock_rate(static_cast<long>(m_clockRate));
+    buffer->set_sample_rate(static_cast<long>(m_sampleRate));
+  }
+  if (m_stems) {
+    for (int c = 0; c < NUM_CHANNELS; ++c) {
+      m_stems->blipBuffers[c]->clock_rate(static_cast<long>(m_clockRate));
+      m_stems->blipBuffers[c]->set_sample_rate(
+          static_cast<long>(m_sampleRate));
+      m_stems->output[c].prepare(m_sampleRate);
+    }
+  }
 
   // Configure NSFPlay cores
   m_apu1->SetClock(m_clockRate);
@@ -49,10 +117,15 @@ void NessyAPU::initialize(double sampleRate) {
   m_vrc6->SetClock(m_clockRate);
   m_vrc6->SetRate(m_sampleRate);
 
+  m_output.prepare(m_sampleRate);
+
   // Disable nondeterministic behavior
   m_apu2->SetOption(xgm::NES_DMC::OPT_RANDOMIZE_TRI, 0);
   m_apu2->SetOption(xgm::NES_DMC::OPT_RANDOMIZE_NOISE, 0);
 
+  // The options the chip sets render with
+  CoreConfig::configure(*m_apu1, *m_apu2);
+
   reset();
 }
 
@@ -60,8 +133,22 @@ void NessyAPU::reset() {
   m_apu1->Reset();
   m_apu2->Reset();
   m_vrc6->Reset();
-  m_blipBuffer->clear();
+  for (int c = 0; c < 2; ++c) {
+    m_blipBuffers[c]->clear();
+    m_blipSynths[c]->clear();
+  }
+  if (m_stems) {
+    for (int c = 0; c < NUM_CHANNELS; ++c) {
+      m_stems->blipBuffers[c]->clear();
+      m_stems->blipSynths[c]->clear();
+      m_stems->level[c] = 0;
+    }
+  }
   m_clockAccumulator = 0.0;
+  m_level[0] = m_level[1] = 0;
+  m_levelDirty = true;
+  m_writeCount = m_writeNext = 0;
+  m_eventClock = 0;
 
   // Reset channel state
   for (int i = 0; i < NUM_CHANNELS; ++i) {
@@ -73,59 +160,649 @@ void NessyAPU::reset() {
   writeRegister(0x4015, 0x0F); // Enable pulse1, pulse2, triangle, noise
 }
 
+// Everything saveState() captures
+struct NessyAPU::State {
+  xgm::NES_APU::State apu1;
+  xgm::NES_DMC::State apu2;
+  xgm::NES_VRC6::State vrc6;
+  blip_buffer_state_t blip[2];
+  int blipLastAmp[2];
+
+  double clockAccumulator;
+  int32_t level[2];
+  uint32_t clocksUntilChange;
+  bool levelDirty;
+
+  bool channelEnabled[NUM_CHANNELS];
+  int currentNote[NUM_CHANNELS];
+  float velocity[NUM_CHANNELS];
+  DutyCycle pulseDuty[2];
+  int vrc6PulseDuty[2];
+  bool noiseShortMode;
+  bool vrc6Enabled;
+};
+
+size_t NessyAPU::getStateSize() {
+  static_assert(std::is_trivially_copyable_v<State>,
+                "NessyAPU::State must stay plain data");
+  return sizeof(State);
+}
+
+void NessyAPU::saveState(void *buffer) const {
+  State state;
+  m_apu1->SaveState(state.apu1);
+  m_apu2->SaveState(state.apu2);
+  m_vrc6->SaveState(state.vrc6);
+  // In mono the right Blip_Buffer is idle, and the left one stands for both
+  for (int c = 0; c < 2; ++c) {
+    const int from = c < numBlipBuffers() ? c : 0;
+    m_blipBuffers[from]->save_state(&state.blip[c]);
+    state.blipLastAmp[c] = m_blipSynths[from]->last_amp();
+    state.level[c] = m_level[c];
+  }
+
+  state.clockAccumulator = m_clockAccumulator;
+  state.clocksUntilChange = m_clocksUntilChange;
+  state.levelDirty = m_levelDirty;
+
+  std::copy_n(m_channelEnabled, NUM_CHANNELS, state.channelEnabled);
+  std::copy_n(m_currentNote, NUM_CHANNELS, state.currentNote);
+  std::copy_n(m_velocity, NUM_CHANNELS, state.velocity);
+  std::copy_n(m_pulseDuty, 2, state.pulseDuty);
+  std::copy_n(m_vrc6PulseDuty, 2, state.vrc6PulseDuty);
+  state.noiseShortMode = m_noiseShortMode;
+  state.vrc6Enabled = m_vrc6Enabled;
+
+  std::memcpy(buffer, &state, sizeof(State));
+}
+
+void NessyAPU::loadState(const void *buffer) {
+  State state;
+  std::memcpy(&state, buffer, sizeof(State));
+
+  m_apu1->LoadState(state.apu1);
+  m_apu2->LoadState(state.apu2);
+  m_vrc6->LoadState(state.vrc6);
+  for (int c = 0; c < 2; ++c) {
+    m_blipBuffers[c]->load_state(state.blip[c]);
+    m_blipSynths[c]->center_dc(state.blipLastAmp[c]);
+    m_level[c] = state.level[c];
+  }
+
+  m_clockAccumulator = state.clockAccumulator;
+  m_clocksUntilChange = state.clocksUntilChange;
+  m_levelDirty = state.levelDirty;
+
+  std::copy_n(state.channelEnabled, NUM_CHANNELS, m_channelEnabled);
+  std::copy_n(state.currentNote, NUM_CHANNELS, m_currentNote);
+  std::copy_n(state.velocity, NUM_CHANNELS, m_velocity);
+  std::copy_n(state.pulseDuty, 2, m_pulseDuty);
+  std::copy_n(state.vrc6PulseDuty, 2, m_vrc6PulseDuty);
+  m_noiseShortMode = state.noiseShortMode;
+  m_vrc6Enabled = state.vrc6Enabled;
+
+  // Writes queued before the restore belong to the old timeline
+  m_writeCount = m_writeNext = 0;
+  m_eventClock = 0;
+
+  selectRenderer();
+
+  // The stems carry on from the restored chips, without filter history
+  if (m_stems) {
+    refreshStemLevels();
+    syncStemBuffers();
+  }
+}
+
 int NessyAPU::process(float *leftOutput, float *rightOutput, int numSamples) {
-  std::fill(leftOutput, leftOutput + numSamples, 0.0f);
-  std::fill(rightOutput, rightOutput + numSamples, 0.0f);
+  return process(leftOutput, rightOutput, nullptr, numSamples);
+}
+
+int NessyAPU::process(float *leftOutput, float *rightOutput,
+                      float *const stemOutputs[NUM_CHANNELS],
+                      int numSamples) {
+  // Lets setTuning() free the tables replaced before this block
+  loadPeriodTable();
+
+  if (stemOutputs != nullptr && !m_stems) {
+    for (int c = 0; c < NUM_CHANNELS; ++c)
+      if (stemOutputs[c] != nullptr)
+        std::fill(stemOutputs[c], stemOutputs[c] + numSamples, 0.0f);
+  }
+
+  m_stemOutputs = stemOutputs;
+  const int samplesGenerated =
+      (this->*m_processFn)(leftOutput, rightOutput, numSamples);
+  m_stemOutputs = nullptr;
+  m_eventClock = 0;
+  return samplesGenerated;
+}
+
+void NessyAPU::setOutputGain(float gain, bool smooth) {
+  m_output.setGain(gain, smooth);
+  if (m_stems)
+    for (auto &output : m_stems->output)
+      output.setGain(gain, smooth);
+}
+
+void NessyAPU::setStemsEnabled(bool enabled) {
+  if (enabled == (m_stems != nullptr))
+    return;
+  if (!enabled) {
+    m_stems.reset();
+    return;
+  }
+
+  m_stems = std::make_unique<Stems>();
+  for (int c = 0; c < NUM_CHANNELS; ++c) {
+    auto &buffer = m_stems->blipBuffers[c];
+    buffer = std::make_unique<Blip_Buffer>();
+    buffer->clock_rate(static_cast<long>(m_clockRate));
+    buffer->set_sample_rate(static_cast<long>(m_sampleRate));
+
+    m_stems->blipSynths[c] = std::make_unique<Blip_Synth<BLIP_QUALITY>>();
+    m_stems->blipSynths[c]->volume(1.0, 16384); // As the main synths
+
+    m_stems->output[c].prepare(m_sampleRate);
+    m_stems->output[c].setGain(m_output.getGain(), false);
+  }
 
+  // Before initialize() there are no chip levels or buffer position to
+  // follow; initialize() resets the stems along with everything else
+  if (m_blipBuffers[0]->sample_rate() != 0) {
+    refreshStemLevels();
+    syncStemBuffers();
+  }
+}
+
+void NessyAPU::setStemNonlinear(bool nonlinear) {
+  m_stemNonlinear = nonlinear;
+  m_levelDirty = true;
+}
+
+void NessyAPU::refreshStemLevels() {
+  if (m_vrc6Enabled) {
+    ChipSetVRC6 chips(*m_apu1, *m_apu2, *m_vrc6);
+    mixStems(chips);
+  } else {
+    ChipSet2A03 chips(*m_apu1, *m_apu2);
+    mixStems(chips);
+  }
+}
+
+void NessyAPU::syncStemBuffers() {
+  // Same clock position as the main buffer, so every buffer yields the same
+  // sample count per frame, with silent impulse tails
+  blip_buffer_state_t state;
+  m_blipBuffers[0]->save_state(&state);
+  state.reader_accum_ = 0;
+  std::fill(std::begin(state.buf), std::end(state.buf), 0);
+  for (int c = 0; c < NUM_CHANNELS; ++c) {
+    m_stems->blipBuffers[c]->load_state(state);
+    m_stems->blipSynths[c]->center_dc(m_stems->level[c]);
+  }
+}
+
+void NessyAPU::writeStems(int offset, int count, bool bandlimited) {
+  if (m_stemOutputs == nullptr)
+    return;
+  for (int c = 0; c < NUM_CHANNELS; ++c) {
+    float *stem = m_stemOutputs[c];
+    if (stem == nullptr)
+      continue;
+    // Mono: the output stage's left and right are the same buffer
+    stem += offset;
+    if (bandlimited)
+      m_stems->output[c].write(m_stems->tempBuffer[c], BLIP_SCALE, stem, stem,
+                               count);
+    else
+      m_stems->output[c].write(m_stems->mixBuffer[c], 1, LEVEL_SCALE, stem,
+                               stem, count);
+  }
+}
+
+void NessyAPU::setRenderMode(RenderMode mode) {
+  m_renderMode = mode;
+  m_levelDirty = true;
+  selectRenderer();
+}
+
+void NessyAPU::selectRenderer() {
+  // Chosen once per configuration change, so the render loops never branch
+  // on the mode or on m_vrc6Enabled
+  switch (m_renderMode) {
+  case RenderMode::SAMPLED:
+    m_processFn = m_vrc6Enabled
+                      ? &NessyAPU::processWith<RenderMode::SAMPLED, true>
+                      : &NessyAPU::processWith<RenderMode::SAMPLED, false>;
+    break;
+  case RenderMode::EVENT_DRIVEN:
+    m_processFn =
+        m_vrc6Enabled ? &NessyAPU::processWith<RenderMode::EVENT_DRIVEN, true>
+                      : &NessyAPU::processWith<RenderMode::EVENT_DRIVEN, false>;
+    break;
+  case RenderMode::BANDLIMITED:
+    m_processFn =
+        m_vrc6Enabled ? &NessyAPU::processWith<RenderMode::BANDLIMITED, true>
+                      : &NessyAPU::processWith<RenderMode::BANDLIMITED, false>;
+    break;
+  }
+}
+
+template <NessyAPU::RenderMode Mode, bool WithVRC6>
+int NessyAPU::processWith(float *leftOutput, float *rightOutput,
+                          int numSamples) {
+  auto render = [&](auto &chips) {
+    if constexpr (Mode == RenderMode::EVENT_DRIVEN)
+      return processEventDriven(chips, leftOutput, rightOutput, numSamples);
+    else if constexpr (Mode == RenderMode::BANDLIMITED)
+      return processBandlimited(chips, leftOutput, rightOutput, numSamples);
+    else
+      return processSampled(chips, leftOutput, rightOutput, numSamples);
+  };
+
+  if constexpr (WithVRC6) {
+    ChipSetVRC6 chips(*m_apu1, *m_apu2, *m_vrc6);
+    return render(chips);
+  } else {
+    ChipSet2A03 chips(*m_apu1, *m_apu2);
+    return render(chips);
+  }
+}
+
+template <typename Chips>
+int NessyAPU::processSampled(Chips &chips, float *leftOutput,
+                             float *rightOutput, int numSamples) {
   int samplesGenerated = 0;
+  uint32_t clock = 0; // Clocks since the start of the block
+  uint32_t writeClock = nextWriteClock();
+
+  // Stems need each sample's channel outputs, so with stems every run is a
+  // single sample, read back after it renders
+  const bool withStems = m_stems != nullptr;
+  auto storeStems = [&](int sample) {
+    mixStems(chips);
+    for (int c = 0; c < NUM_CHANNELS; ++c)
+      m_stems->mixBuffer[c][sample] = m_stems->level[c];
+  };
 
   while (samplesGenerated < numSamples) {
-    m_clockAccumulator += m_clocksPerSample;
-    int clocksToRun = static_cast<int>(m_clockAccumulator);
-    m_clockAccumulator -= clocksToRun;
+    const int count =
+        std::min(numSamples - samplesGenerated, TEMP_BUFFER_SIZE);
+
+    // Work out every sample's clock count up front so the chips can render
+    // the chunk in blocks.
+    for (int i = 0; i < count; ++i) {
+      m_clockAccumulator += m_clocksPerSample;
+      const int clocksToRun = static_cast<int>(m_clockAccumulator);
+      m_clockAccumulator -= clocksToRun;
+      m_clockSchedule[i] = static_cast<uint32_t>(clocksToRun);
+    }
+
+    std::fill(m_mixBuffer, m_mixBuffer + count * 2, 0);
+
+    // A frame sequencer step changes chip state, so it can only fall on the
+    // first sample of a block, before that sample's clocks reach the chips.
+    int start = 0;
+    while (start < count) {
+      // A sample with queued writes inside is split around them
+      if (writeClock < clock + m_clockSchedule[start]) {
+        uint32_t elapsed = 0;
+        do {
+          chips.tick(writeClock - clock - elapsed);
+          elapsed = writeClock - clock;
+          applyWritesUntil(writeClock);
+          writeClock = nextWriteClock();
+        } while (writeClock < clock + m_clockSchedule[start]);
+
+        uint32_t rest = m_clockSchedule[start] - elapsed;
+        chips.tickFrameSequence(rest);
+        chips.renderBlock(m_mixBuffer + start * 2, 1, &rest);
+        if (withStems)
+          storeStems(start);
+        clock += m_clockSchedule[start++];
+        continue;
+      }
+
+      chips.tickFrameSequence(m_clockSchedule[start]);
+      clock += m_clockSchedule[start];
+
+      // Runs also stop before the next sample with a write inside
+      const uint32_t budget = chips.clocksUntilFrameSequence();
+      uint32_t runClocks = 0;
+      int end = start + 1;
+      while (!withStems && end < count &&
+             runClocks + m_clockSchedule[end] <= budget &&
+             writeClock >= clock + m_clockSchedule[end]) {
+        clock += m_clockSchedule[end];
+        runClocks += m_clockSchedule[end++];
+      }
+      chips.tickFrameSequence(runClocks);
+
+      chips.renderBlock(m_mixBuffer + start * 2,
+                        static_cast<uint32_t>(end - start),
+                        m_clockSchedule + start);
+      if (withStems)
+        storeStems(start);
+
+      start = end;
+    }
+
+    if (m_stereo)
+      m_output.write(m_mixBuffer, m_mixBuffer + 1, 2, LEVEL_SCALE,
+                     leftOutput + samplesGenerated,
+                     rightOutput + samplesGenerated, count);
+    else
+      m_output.write(m_mixBuffer, 2, LEVEL_SCALE,
+                     leftOutput + samplesGenerated,
+                     rightOutput + samplesGenerated, count);
+    if (withStems)
+      writeStems(samplesGenerated, count, false);
+    samplesGenerated += count;
+  }
+
+  carryWritesOver(clock);
+  return samplesGenerated;
+}
+
+template <typename Chips>
+int NessyAPU::processEventDriven(Chips &chips, float *leftOutput,
+                                 float *rightOutput, int numSamples) {
+  if (m_levelDirty)
+    refreshLevel(chips);
+
+  // Clocks elapsed since the chips were last ticked. The chips are only
+  // ticked when a level change is due, so the cost of a block depends on the
+  // number of waveform edges rather than on the sample rate.
+  uint32_t pendingClocks = 0;
+  uint32_t clock = 0; // Clocks since the start of the block
+  uint32_t writeClock = nextWriteClock();
+
+  // The level of each sample is collected a chunk at a time and converted
+  // by the output stage
+  constexpr int CHUNK = TEMP_BUFFER_SIZE;
+  for (int chunkStart = 0; chunkStart < numSamples; chunkStart += CHUNK) {
+    const int count = std::min(numSamples - chunkStart, CHUNK);
+
+    for (int i = 0; i < count; ++i) {
+      m_clockAccumulator += m_clocksPerSample;
+      int clocksToRun = static_cast<int>(m_clockAccumulator);
+      m_clockAccumulator -= clocksToRun;
+      pendingClocks += static_cast<uint32_t>(clocksToRun);
+      clock += static_cast<uint32_t>(clocksToRun);
+
+      // Catch the chips up to each queued write inside this sample
+      while (writeClock < clock) {
+        const uint32_t clocksToWrite = pendingClocks - (clock - writeClock);
+        advanceEvents(chips, clocksToWrite);
+        pendingClocks -= clocksToWrite;
+        applyWritesUntil(writeClock);
+        refreshLevel(chips);
+        writeClock = nextWriteClock();
+      }
 
-    if (clocksToRun > 0) {
-      clockAPU(clocksToRun);
+      while (pendingClocks >= m_clocksUntilChange) {
+        pendingClocks -= m_clocksUntilChange;
+        stepToLevelChange(chips);
+      }
+
+      m_mixBuffer[i * 2] = m_level[0];
+      m_mixBuffer[i * 2 + 1] = m_level[1];
+      if (m_stems)
+        for (int c = 0; c < NUM_CHANNELS; ++c)
+          m_stems->mixBuffer[c][i] = m_stems->level[c];
     }
 
-    // Get mixed output from base APU
-    int32_t out[2] = {0, 0};
-    m_apu1->Render(out);
+    if (m_stereo)
+      m_output.write(m_mixBuffer, m_mixBuffer + 1, 2, LEVEL_SCALE,
+                     leftOutput + chunkStart, rightOutput + chunkStart, count);
+    else
+      m_output.write(m_mixBuffer, 2, LEVEL_SCALE, leftOutput + chunkStart,
+                     rightOutput + chunkStart, count);
+    if (m_stems)
+      writeStems(chunkStart, count, false);
+  }
+
+  // Catch the chips up to the end of the block, so register writes made
+  // before the next block land at the right emulated time
+  advanceWithinLevel(chips, pendingClocks);
+
+  carryWritesOver(clock);
+  return numSamples;
+}
+
+template <typename Chips>
+int NessyAPU::processBandlimited(Chips &chips, float *leftOutput,
+                                 float *rightOutput, int numSamples) {
+  if (m_levelDirty)
+    refreshLevel(chips);
+
+  int samplesGenerated = 0;
+  uint32_t frameStart = 0; // Clocks from the start of the block
+  uint32_t writeClock = nextWriteClock();
+
+  while (samplesGenerated < numSamples) {
+    const int count =
+        std::min(numSamples - samplesGenerated, TEMP_BUFFER_SIZE);
+    const blip_nclock_t frameClocks = m_blipBuffers[0]->count_clocks(count);
+    const uint32_t frameEnd = frameStart + static_cast<uint32_t>(frameClocks);
+
+    // Picks up level changes from register writes since the last frame
+    updateBlip(0);
 
-    int32_t out2[2] = {0, 0};
-    m_apu2->Render(out2);
-    out[0] += out2[0];
+    // Each level change becomes a bandlimited step at its CPU-clock time,
+    // and so does each queued write
+    blip_nclock_t time = 0;
+    for (;;) {
+      const bool writeDue = writeClock < frameEnd;
+      const blip_nclock_t until = writeDue ? writeClock - frameStart
+                                           : frameClocks;
+      while (until - time >= m_clocksUntilChange) {
+        time += m_clocksUntilChange;
+        stepToLevelChange(chips);
+        updateBlip(time);
+      }
+      if (!writeDue)
+        break;
 
-    // Add VRC6 output if enabled
-    if (m_vrc6Enabled) {
-      int32_t vrc6Out[2] = {0, 0};
-      m_vrc6->Render(vrc6Out);
-      out[0] += vrc6Out[0];
+      advanceWithinLevel(chips, static_cast<uint32_t>(until - time));
+      time = until;
+      applyWritesUntil(writeClock);
+      refreshLevel(chips);
+      updateBlip(time);
+      writeClock = nextWriteClock();
     }
+    advanceWithinLevel(chips, frameClocks - time);
+    frameStart = frameEnd;
 
-    // Convert to float [-1, 1]
-    float sample = static_cast<float>(out[0]) / 8192.0f;
-    sample = std::clamp(sample, -1.0f, 1.0f);
+    // Both buffers see the same frames, so they always hold the same
+    // number of samples
+    int samplesRead = 0;
+    for (int c = 0; c < numBlipBuffers(); ++c) {
+      m_blipBuffers[c]->end_frame(frameClocks);
+      samplesRead = static_cast<int>(m_blipBuffers[c]->read_samples(
+          m_tempBuffer[c], static_cast<blip_nsamp_t>(count)));
+    }
+    if (m_stems) {
+      for (int c = 0; c < NUM_CHANNELS; ++c) {
+        m_stems->blipBuffers[c]->end_frame(frameClocks);
+        m_stems->blipBuffers[c]->read_samples(
+            m_stems->tempBuffer[c], static_cast<blip_nsamp_t>(count));
+      }
+    }
+    if (samplesRead == 0)
+      break;
 
-    leftOutput[samplesGenerated] = sample;
-    rightOutput[samplesGenerated] = sample;
-    ++samplesGenerated;
+    if (m_stereo)
+      m_output.write(m_tempBuffer[0], m_tempBuffer[1], BLIP_SCALE,
+                     leftOutput + samplesGenerated,
+                     rightOutput + samplesGenerated, samplesRead);
+    else
+      m_output.write(m_tempBuffer[0], BLIP_SCALE,
+                     leftOutput + samplesGenerated,
+                     rightOutput + samplesGenerated, samplesRead);
+    if (m_stems)
+      writeStems(samplesGenerated, samplesRead, true);
+    samplesGenerated += samplesRead;
   }
 
+  carryWritesOver(frameStart);
   return samplesGenerated;
 }
 
-void NessyAPU::clockAPU(int cpuClocks) {
-  m_apu2->TickFrameSequence(cpuClocks);
-  m_apu1->Tick(cpuClocks);
-  m_apu2->Tick(cpuClocks);
+void NessyAPU::fastForward(int numSamples) {
+  applyWritesUntil(UINT32_MAX);
+  m_writeCount = m_writeNext = 0;
+  m_eventClock = 0;
 
-  // Clock VRC6 if enabled
   if (m_vrc6Enabled) {
-    m_vrc6->Tick(cpuClocks);
+    ChipSetVRC6 chips(*m_apu1, *m_apu2, *m_vrc6);
+    fastForwardChips(chips, numSamples);
+  } else {
+    ChipSet2A03 chips(*m_apu1, *m_apu2);
+    fastForwardChips(chips, numSamples);
   }
 }
 
+template <typename Chips>
+void NessyAPU::fastForwardChips(Chips &chips, int numSamples) {
+  if (m_renderMode == RenderMode::SAMPLED) {
+    // The frame sequencer runs of processSampled(), each run's clocks given
+    // to the chips in one tick instead of sample by sample
+    for (int done = 0; done < numSamples;) {
+      const int count = std::min(numSamples - done, TEMP_BUFFER_SIZE);
+      for (int i = 0; i < count; ++i) {
+        m_clockAccumulator += m_clocksPerSample;
+        const int clocksToRun = static_cast<int>(m_clockAccumulator);
+        m_clockAccumulator -= clocksToRun;
+        m_clockSchedule[i] = static_cast<uint32_t>(clocksToRun);
+      }
+
+      int start = 0;
+      while (start < count) {
+        chips.tickFrameSequence(m_clockSchedule[start]);
+
+        const uint32_t budget = chips.clocksUntilFrameSequence();
+        uint32_t runClocks = 0;
+        int end = start + 1;
+        while (end < count && runClocks + m_clockSchedule[end] <= budget)
+          runClocks += m_clockSchedule[end++];
+        chips.tickFrameSequence(runClocks);
+
+        chips.tickChips(m_clockSchedule[start] + runClocks);
+        start = end;
+      }
+      done += count;
+    }
+    return;
+  }
+
+  // The event-driven renderers tick the chips exactly at level changes, so
+  // keep the same tick boundaries and only skip the mixing
+  if (m_levelDirty) {
+    chips.tick(0);
+    m_clocksUntilChange = chips.clocksUntilLevelChange();
+    m_levelDirty = false;
+  }
+  auto advance = [&](uint32_t cpuClocks) {
+    while (cpuClocks >= m_clocksUntilChange) {
+      cpuClocks -= m_clocksUntilChange;
+      chips.tick(m_clocksUntilChange);
+      m_clocksUntilChange = chips.clocksUntilLevelChange();
+    }
+    advanceWithinLevel(chips, cpuClocks);
+  };
+
+  if (m_renderMode == RenderMode::EVENT_DRIVEN) {
+    uint32_t pendingClocks = 0;
+    for (int i = 0; i < numSamples; ++i) {
+      m_clockAccumulator += m_clocksPerSample;
+      const int clocksToRun = static_cast<int>(m_clockAccumulator);
+      m_clockAccumulator -= clocksToRun;
+      pendingClocks += static_cast<uint32_t>(clocksToRun);
+    }
+    advance(pendingClocks);
+  } else {
+    // Keep Blip_Buffer's clock-to-sample timing, with nothing synthesized
+    for (int done = 0; done < numSamples;) {
+      const int count = std::min(numSamples - done, TEMP_BUFFER_SIZE);
+      const blip_nclock_t frameClocks = m_blipBuffers[0]->count_clocks(count);
+      advance(frameClocks);
+      for (int c = 0; c < numBlipBuffers(); ++c) {
+        m_blipBuffers[c]->end_frame(frameClocks);
+        m_blipBuffers[c]->remove_samples(static_cast<blip_nsamp_t>(count));
+      }
+      if (m_stems) {
+        for (auto &buffer : m_stems->blipBuffers) {
+          buffer->end_frame(frameClocks);
+          buffer->remove_samples(static_cast<blip_nsamp_t>(count));
+        }
+      }
+      done += count;
+    }
+  }
+
+  mixLevels(chips);
+  for (int c = 0; c < 2; ++c)
+    m_blipSynths[c]->center_dc(m_level[c]);
+  if (m_stems)
+    for (int c = 0; c < NUM_CHANNELS; ++c)
+      m_stems->blipSynths[c]->center_dc(m_stems->level[c]);
+}
+
+template <typename Chips> void NessyAPU::stepToLevelChange(Chips &chips) {
+  chips.tick(m_clocksUntilChange);
+  mixLevels(chips);
+  m_clocksUntilChange = chips.clocksUntilLevelChange();
+}
+
+template <typename Chips>
+void NessyAPU::advanceWithinLevel(Chips &chips, uint32_t cpuClocks) {
+  // Callers guarantee cpuClocks < m_clocksUntilChange
+  if (cpuClocks > 0) {
+    chips.tick(cpuClocks);
+    m_clocksUntilChange -= cpuClocks;
+  }
+}
+
+template <typename Chips>
+void NessyAPU::advanceEvents(Chips &chips, uint32_t cpuClocks) {
+  while (cpuClocks >= m_clocksUntilChange) {
+    cpuClocks -= m_clocksUntilChange;
+    stepToLevelChange(chips);
+  }
+  advanceWithinLevel(chips, cpuClocks);
+}
+
+void NessyAPU::updateBlip(uint32_t time) {
+  for (int c = 0; c < numBlipBuffers(); ++c)
+    m_blipSynths[c]->update(time, m_level[c], m_blipBuffers[c].get());
+  if (m_stems)
+    for (int c = 0; c < NUM_CHANNELS; ++c)
+      m_stems->blipSynths[c]->update(time, m_stems->level[c],
+                                     m_stems->blipBuffers[c].get());
+}
+
+template <typename Chips> void NessyAPU::mixLevels(Chips &chips) {
+  chips.mixLevels(m_level);
+  if (m_stems)
+    mixStems(chips);
+}
+
+template <typename Chips> void NessyAPU::mixStems(Chips &chips) {
+  // Without the VRC6 its stems stay silent
+  const int count = chips.mixChannels(m_stems->level, m_stemNonlinear);
+  std::fill(m_stems->level + count, m_stems->level + NUM_CHANNELS, 0);
+}
+
+template <typename Chips> void NessyAPU::refreshLevel(Chips &chips) {
+  // A zero-clock tick recomputes the chip outputs after register writes
+  chips.tick(0);
+  mixLevels(chips);
+  m_clocksUntilChange = chips.clocksUntilLevelChange();
+  m_levelDirty = false;
+}
+
 void NessyAPU::noteOn(int channel, int midiNote, float velocity) {
   if (channel < 0 || channel >= NUM_CHANNELS)
     return;
@@ -133,6 +810,7 @@ void NessyAPU::noteOn(int channel, int midiNote, float velocity) {
   m_currentNote[channel] = midiNote;
   m_velocity[channel] = velocity;
 
+  loadPeriodTable();
   uint16_t period = midiToPeriod(midiNote, channel);
   uint8_t volume = static_cast<uint8_t>(velocity * 15.0f);
 
@@ -159,7 +837,7 @@ void NessyAPU::noteOn(int channel, int midiNote, float velocity) {
   }
   case NOISE: {
     writeRegister(0x400C, 0x30 | volume);
-    uint8_t noisePeriod = std::clamp(15 - (midiNote / 8), 0, 15);
+    uint8_t noisePeriod = m_audioTable->getNoisePeriod(midiNote);
     uint8_t mode = m_noiseShortMode ? 0x80 : 0x00;
     writeRegister(0x400E, mode | noisePeriod);
     writeRegister(0x400F, 0xF8);
@@ -174,28 +852,28 @@ void NessyAPU::noteOn(int channel, int midiNote, float velocity) {
     // $9000: D6-D4 = Duty, D3-D0 = Volume (or D7=1 for constant volume)
     uint8_t vrc6Volume = static_cast<uint8_t>(velocity * 15.0f);
     uint8_t vrc6Duty = static_cast<uint8_t>(m_vrc6PulseDuty[0]) << 4;
-    m_vrc6->Write(0x9000, vrc6Duty | vrc6Volume);
-    m_vrc6->Write(0x9001, period & 0xFF);
-    m_vrc6->Write(0x9002,
-                  0x80 | ((period >> 8) & 0x0F)); // Enable + period high
+    writeVRC6Register(0x9000, vrc6Duty | vrc6Volume);
+    writeVRC6Register(0x9001, period & 0xFF);
+    writeVRC6Register(0x9002,
+                      0x80 | ((period >> 8) & 0x0F)); // Enable + period high
     break;
   }
   case VRC6_PULSE2: {
     // VRC6 Pulse 2: $A000-$A002
     uint8_t vrc6Volume = static_cast<uint8_t>(velocity * 15.0f);
     uint8_t vrc6Duty = static_cast<uint8_t>(m_vrc6PulseDuty[1]) << 4;
-    m_vrc6->Write(0xA000, vrc6Duty | vrc6Volume);
-    m_vrc6->Write(0xA001, period & 0xFF);
-    m_vrc6->Write(0xA002, 0x80 | ((period >> 8) & 0x0F));
+    writeVRC6Register(0xA000, vrc6Duty | vrc6Volume);
+    writeVRC6Register(0xA001, period & 0xFF);
+    writeVRC6Register(0xA002, 0x80 | ((period >> 8) & 0x0F));
     break;
   }
   case VRC6_SAW: {
     // VRC6 Sawtooth: $B000-$B002
     // $B000: D5-D0 = Accumulator rate (volume)
     uint8_t sawVolume = static_cast<uint8_t>(velocity * 42.0f); // 0-42 range
-    m_vrc6->Write(0xB000, sawVolume & 0x3F);
-    m_vrc6->Write(0xB001, period & 0xFF);
-    m_vrc6->Write(0xB002, 0x80 | ((period >> 8) & 0x0F));
+    writeVRC6Register(0xB000, sawVolume & 0x3F);
+    writeVRC6Register(0xB001, period & 0xFF);
+    writeVRC6Register(0xB002, 0x80 | ((period >> 8) & 0x0F));
     break;
   }
   }
@@ -226,13 +904,13 @@ void NessyAPU::noteOff(int channel) {
 
   // VRC6 note off
   case VRC6_PULSE1:
-    m_vrc6->Write(0x9002, 0x00); // Disable channel
+    writeVRC6Register(0x9002, 0x00); // Disable channel
     break;
   case VRC6_PULSE2:
-    m_vrc6->Write(0xA002, 0x00);
+    writeVRC6Register(0xA002, 0x00);
     break;
   case VRC6_SAW:
-    m_vrc6->Write(0xB002, 0x00);
+    writeVRC6Register(0xB002, 0x00);
     break;
   }
 }
@@ -279,19 +957,72 @@ void NessyAPU::setNoiseMode(bool shortMode) {
   m_noiseShortMode = shortMode;
 
   if (m_currentNote[NOISE] >= 0) {
-    uint8_t noisePeriod = std::clamp(15 - (m_currentNote[NOISE] / 8), 0, 15);
+    loadPeriodTable();
+    uint8_t noisePeriod = m_audioTable->getNoisePeriod(m_currentNote[NOISE]);
     uint8_t mode = shortMode ? 0x80 : 0x00;
     writeRegister(0x400E, mode | noisePeriod);
   }
 }
 
+void NessyAPU::setChannelPan(int channel, float pan) {
+  if (channel < 0 || channel >= NUM_CHANNELS)
+    return;
+  m_pan[channel] = std::clamp(pan, -1.0f, 1.0f);
+
+  // Constant power, scaled so a centred channel gets 128 (unity) per side
+  const double angle = (m_pan[channel] + 1.0) * (std::acos(-1.0) / 4.0);
+  const double scale = 128.0 * std::sqrt(2.0);
+  const auto left =
+      static_cast<xgm::INT16>(std::lround(scale * std::cos(angle)));
+  const auto right =
+      static_cast<xgm::INT16>(std::lround(scale * std::sin(angle)));
+
+  switch (channel) {
+  case PULSE1:
+  case PULSE2:
+    m_apu1->SetStereoMix(channel - PULSE1, left, right);
+    break;
+  case TRIANGLE:
+  case NOISE:
+  case DMC:
+    m_apu2->SetStereoMix(channel - TRIANGLE, left, right);
+    break;
+  case VRC6_PULSE1:
+  case VRC6_PULSE2:
+  case VRC6_SAW:
+    m_vrc6->SetStereoMix(channel - VRC6_PULSE1, left, right);
+    break;
+  }
+  m_levelDirty = true;
+
+  const bool stereo = std::any_of(m_pan, m_pan + NUM_CHANNELS,
+                                  [](float p) { return p != 0.0f; });
+  if (stereo && !m_stereo) {
+    // The idle right Blip_Buffer picks up where the left one, which has
+    // carried the mono signal, stands
+    blip_buffer_state_t state;
+    m_blipBuffers[0]->save_state(&state);
+    m_blipBuffers[1]->load_state(state);
+    m_blipSynths[1]->center_dc(m_blipSynths[0]->last_amp());
+  }
+  m_stereo = stereo;
+}
+
+float NessyAPU::getChannelPan(int channel) const {
+  if (channel < 0 || channel >= NUM_CHANNELS)
+    return 0.0f;
+  return m_pan[channel];
+}
+
 void NessyAPU::setVRC6Enabled(bool enabled) {
   m_vrc6Enabled = enabled;
+  m_levelDirty = true;
+  selectRenderer();
   if (!enabled) {
     // Silence all VRC6 channels
-    m_vrc6->Write(0x9002, 0x00);
-    m_vrc6->Write(0xA002, 0x00);
-    m_vrc6->Write(0xB002, 0x00);
+    writeVRC6Register(0x9002, 0x00);
+    writeVRC6Register(0xA002, 0x00);
+    writeVRC6Register(0xB002, 0x00);
   }
 }
 
@@ -299,6 +1030,14 @@ void NessyAPU::setVRC6PulseDuty(int pulseChannel, int duty) {
   if (pulseChannel < 0 || pulseChannel > 1)
     return;
   m_vrc6PulseDuty[pulseChannel] = std::clamp(duty, 0, 7);
+
+  int channel = (pulseChannel == 0) ? VRC6_PULSE1 : VRC6_PULSE2;
+  if (m_currentNote[channel] >= 0) {
+    uint8_t dutyBits = static_cast<uint8_t>(m_vrc6PulseDuty[pulseChannel]) << 4;
+    uint8_t volume = static_cast<uint8_t>(m_velocity[channel] * 15.0f);
+    uint16_t addr = (pulseChannel == 0) ? 0x9000 : 0xA000;
+    writeVRC6Register(addr, dutyBits | volume);
+  }
 }
 
 double NessyAPU::getChannelFrequency(int channel) const {
@@ -309,22 +1048,162 @@ double NessyAPU::getChannelFrequency(int channel) const {
   if (note < 0)
     return 0.0;
 
-  return FREQ_A4 * std::pow(2.0, (note - MIDI_A4) / 12.0);
+  return m_activeTable->getFrequency(note);
+}
+
+void NessyAPU::setTuning(const PeriodTable::Tuning &tuning) {
+  if (m_activeTable && m_activeTable->getTuning() == tuning)
+    return;
+
+  auto table = std::make_unique<PeriodTable>(tuning, m_clockRate);
+  m_periodTable.store(table.get(), std::memory_order_release);
+  const uint32_t epoch =
+      m_tableEpoch.fetch_add(1, std::memory_order_acq_rel) + 1;
+
+  // Free the tables the audio thread has moved on from
+  const uint32_t loaded = m_loadedEpoch.load(std::memory_order_acquire);
+  m_retiredTables.erase(
+      std::remove_if(m_retiredTables.begin(), m_retiredTables.end(),
+                     [loaded](const RetiredTable &retired) {
+                       return static_cast<int32_t>(loaded - retired.epoch) >=
+                              0;
+                     }),
+      m_retiredTables.end());
+
+  if (m_activeTable)
+    m_retiredTables.push_back({epoch, std::move(m_activeTable)});
+  m_activeTable = std::move(table);
+}
+
+void NessyAPU::loadPeriodTable() {
+  // The epoch is read first, so the table is at least as new as it
+  const uint32_t epoch = m_tableEpoch.load(std::memory_order_acquire);
+  m_audioTable = m_periodTable.load(std::memory_order_acquire);
+  m_loadedEpoch.store(epoch, std::memory_order_release);
 }
 
 void NessyAPU::writeRegister(uint16_t address, uint8_t value) {
-  m_apu1->Write(address, value);
-  m_apu2->Write(address, value);
+  if (registerOwner(address) == RegisterOwner::NONE)
+    return;
+  if (m_eventClock > 0 || m_writeCount > 0) {
+    queueWrite(address, value, false);
+    return;
+  }
+  write2A03(address, value);
+  m_levelDirty = true;
 }
 
-uint16_t NessyAPU::midiToPeriod(int midiNote, int channel) const {
-  double freq = FREQ_A4 * std::pow(2.0, (midiNote - MIDI_A4) / 12.0);
+void NessyAPU::writeVRC6Register(uint16_t address, uint8_t value) {
+  if (m_eventClock > 0 || m_writeCount > 0) {
+    queueWrite(address, value, true);
+    return;
+  }
+  m_vrc6->Write(address, value);
+  m_levelDirty = true;
+}
+
+void NessyAPU::setEventOffset(int sampleOffset) {
+  sampleOffset = std::max(0, sampleOffset);
+
+  // The clock at which the renderer starts that sample
+  if (m_renderMode == RenderMode::BANDLIMITED) {
+    // Follows processBandlimited() frame by frame. count_clocks() over the
+    // whole offset would clamp at the Blip_Buffer's length.
+    const Blip_Buffer &buffer = *m_blipBuffers[0];
+    const Blip_Buffer::resampled_time_t factor = buffer.resampled_duration(1);
+    Blip_Buffer::resampled_time_t offset = buffer.resampled_time(0);
+    uint64_t clock = 0;
+    for (int remaining = sampleOffset;;) {
+      const int count = std::min(remaining, TEMP_BUFFER_SIZE);
+      const Blip_Buffer::resampled_time_t time =
+          static_cast<Blip_Buffer::resampled_time_t>(count)
+          << BLIP_BUFFER_ACCURACY;
+      const Blip_Buffer::resampled_time_t frameClocks =
+          (time - offset + factor - 1) / factor;
+      clock += frameClocks;
+      remaining -= count;
+      if (remaining == 0)
+        break;
+      offset += frameClocks * factor - time; // What end_frame() leaves
+    }
+    m_eventClock =
+        static_cast<uint32_t>(std::min<uint64_t>(clock, 4000000000u));
+  } else {
+    const double clock = m_clockAccumulator + sampleOffset * m_clocksPerSample;
+    m_eventClock = static_cast<uint32_t>(std::min(clock, 4.0e9));
+  }
+}
+
+void NessyAPU::queueWrite(uint16_t address, uint8_t value, bool vrc6) {
+  // When the queue is full, everything queued lands now, early but in order
+  if (m_writeCount == WRITE_QUEUE_SIZE) {
+    applyWritesUntil(UINT32_MAX);
+    m_writeCount = m_writeNext = 0;
+  }
+
+  // Keep the queue in time order even if the offset went backwards
+  uint32_t clock = m_eventClock;
+  if (m_writeCount > 0)
+    clock = std::max(clock, m_writeQueue[m_writeCount - 1].clock);
+
+  m_writeQueue[m_writeCount++] = {clock, address, value, vrc6};
+}
+
+void NessyAPU::applyWrite(const RegisterWrite &write) {
+  if (write.vrc6) {
+    m_vrc6->Write(write.address, write.value);
+  } else {
+    write2A03(write.address, write.value);
+  }
+  m_levelDirty = true;
+}
+
+void NessyAPU::write2A03(uint16_t address, uint8_t value) {
+  switch (registerOwner(address)) {
+  case RegisterOwner::APU1:
+    m_apu1->Write(address, value);
+    break;
+  case RegisterOwner::APU2:
+    m_apu2->Write(address, value);
+    break;
+  case RegisterOwner::BOTH:
+    m_apu1->Write(address, value);
+    m_apu2->Write(address, value);
+    break;
+  case RegisterOwner::NONE:
+    break;
+  }
+}
+
+void NessyAPU::applyWritesUntil(uint32_t clock) {
+  while (m_writeNext < m_writeCount &&
+         m_writeQueue[m_writeNext].clock <= clock)
+    applyWrite(m_writeQueue[m_writeNext++]);
+}
+
+void NessyAPU::carryWritesOver(uint32_t blockClocks) {
+  int kept = 0;
+  for (int i = m_writeNext; i < m_writeCount; ++i) {
+    RegisterWrite write = m_writeQueue[i];
+    write.clock -= std::min(blockClocks, write.clock);
+    m_writeQueue[kept++] = write;
+  }
+  m_writeCount = kept;
+  m_writeNext = 0;
+}
 
-  // VRC6 uses same period formula as base NES
-  double divider = (channel == TRIANGLE) ? 32.0 : 16.0;
-  double period = (m_clockRate / (divider * freq)) - 1.0;
+uint16_t NessyAPU::midiToPeriod(int midiNote, int channel) const {
+  const PeriodTable *table = m_audioTable;
 
-  // VRC6 has 12-bit period, base NES has 11-bit
-  double maxPeriod = (channel >= VRC6_PULSE1) ? 4095.0 : 2047.0;
-  return static_cast<uint16_t>(std::clamp(period, 0.0, maxPeriod));
+  switch (channel) {
+  case TRIANGLE:
+    return table->getPeriod(PeriodTable::TRIANGLE_2A03, midiNote);
+  case VRC6_PULSE1:
+  case VRC6_PULSE2:
+    return table->getPeriod(PeriodTable::PULSE_VRC6, midiNote);
+  case VRC6_SAW:
+    return table->getPeriod(PeriodTable::SAW_VRC6, midiNote);
+  default:
+    return table->getPeriod(PeriodTable::PULSE_2A03, midiNote);
+  }
 }
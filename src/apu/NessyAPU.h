@@ -3,8 +3,14 @@
 // NessyAPU: NES APU wrapper for VST use with expansion chip support
 // GPL-3.0 - Uses NSFPlay cores from Dn-FamiTracker
 
+#include "OutputStage.h"
+#include "PeriodTable.h"
+
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 #include <memory>
+#include <vector>
 
 // Forward declarations for NSFPlay types
 namespace xgm {
@@ -39,6 +45,13 @@ public:
     DUTY_75 = 3    // 75% (inverted 25%)
   };
 
+  // How process() advances the emulation
+  enum class RenderMode {
+    SAMPLED,      // Tick and render every chip once per output sample
+    EVENT_DRIVEN, // Tick only at level changes, hold the level in between
+    BANDLIMITED   // Feed level changes into Blip_Buffer at CPU-clock time
+  };
+
   NessyAPU();
   ~NessyAPU();
 
@@ -51,6 +64,41 @@ public:
   // Generate audio samples
   int process(float *leftOutput, float *rightOutput, int numSamples);
 
+  // The same, also writing each channel's stem to stemOutputs[channel] (see
+  // setStemsEnabled()). Null entries are skipped; without stems enabled the
+  // stem outputs are cleared.
+  int process(float *leftOutput, float *rightOutput,
+              float *const stemOutputs[NUM_CHANNELS], int numSamples);
+
+  // Advance the emulation by numSamples as process() would, without mixing
+  // or producing audio. The chip state afterwards is exactly the state
+  // process() leaves; in BANDLIMITED mode the band-limited filter history is
+  // lost, so render a few thousand samples of pre-roll before using the
+  // output.
+  void fastForward(int numSamples);
+
+  // Gain applied as process() converts the chip output to float, after
+  // clipping. Changes ramp over OutputStage::RAMP_SECONDS unless smooth is
+  // false; initialize() finishes any ramp in progress.
+  // The stems take the same gain.
+  void setOutputGain(float gain, bool smooth = true);
+  float getOutputGain() const { return m_output.getGain(); }
+
+  // Per-channel stems: every channel's own level, mono and unpanned, taken
+  // from the chips' per-channel outputs in the same emulation pass as the
+  // mix. With nonlinear set each stem goes through the 2A03's nonlinear DAC
+  // as if it played alone, otherwise through the cores' linear mixer; the
+  // VRC6 is linear either way. Enabling allocates the stem buffers, so call
+  // it off the audio thread. Stems are not part of the saved state.
+  void setStemsEnabled(bool enabled);
+  bool getStemsEnabled() const { return m_stems != nullptr; }
+  void setStemNonlinear(bool nonlinear);
+  bool getStemNonlinear() const { return m_stemNonlinear; }
+
+  // Render mode selection
+  void setRenderMode(RenderMode mode);
+  RenderMode getRenderMode() const { return m_renderMode; }
+
   // MIDI note control
   void noteOn(int channel, int midiNote, float velocity);
   void noteOff(int channel);
@@ -60,27 +108,150 @@ public:
   void setPulseDuty(int pulseChannel, DutyCycle duty);
   void setNoiseMode(bool shortMode);
 
+  // Stereo position of a channel, -1 (left) to 1 (right), applied through
+  // the cores' stereo mix matrices with a constant-power law. Centre keeps
+  // the cores' unity mix on both sides; until some channel is panned the
+  // output is mono and BANDLIMITED mode runs a single Blip_Buffer.
+  void setChannelPan(int channel, float pan);
+  float getChannelPan(int channel) const;
+
   // VRC6-specific configuration
   void setVRC6Enabled(bool enabled);
   void setVRC6PulseDuty(int pulseChannel, int duty); // 0-7 (8 levels)
 
-  // Get channel frequency for visualization
+  // Get channel frequency for visualization, on the thread that calls
+  // setTuning()
   double getChannelFrequency(int channel) const;
 
+  // Tuning used by note-ons from now on. Builds new period tables on the
+  // calling thread, so call it off the audio thread, and always from the
+  // same one.
+  void setTuning(const PeriodTable::Tuning &tuning);
+
   // Direct register access (for advanced use)
   void writeRegister(uint16_t address, uint8_t value);
 
+  // Timestamps the register writes made from now on (note on/off, channel
+  // setters, writeRegister) at this many samples into the next process()
+  // call. They wait in a preallocated queue, and process() advances the
+  // chips to each write's exact CPU clock before applying it, so a whole
+  // block of events can be queued and rendered in one call. Writes past
+  // the end of a block carry over to the next one. Offsets must not
+  // decrease between process() calls; process() resets the offset to 0,
+  // and writes made at offset 0 with nothing queued apply immediately.
+  // fastForward() applies queued writes up front.
+  void setEventOffset(int sampleOffset);
+
+  // Emulator state snapshots: every chip's registers, dividers, phases,
+  // LFSR, envelopes and frame sequencer, plus note and render state. The
+  // state is plain data, so saving and restoring are a few memcpys. The
+  // buffer must hold getStateSize() bytes. Restore only into an NessyAPU
+  // initialized at the same sample rate; render mode and tuning are
+  // configuration and are not part of the state, and neither are queued
+  // register writes (see setEventOffset()).
+  static size_t getStateSize();
+  void saveState(void *buffer) const;
+  void loadState(const void *buffer);
+
 private:
+  struct State;
+  struct Stems;
+
   uint16_t midiToPeriod(int midiNote, int channel) const;
-  void clockAPU(int cpuClocks);
+  void writeVRC6Register(uint16_t address, uint8_t value);
+
+  // A register write waiting for its CPU clock, counted from the start of
+  // the next process() call
+  struct RegisterWrite {
+    uint32_t clock;
+    uint16_t address;
+    uint8_t value;
+    bool vrc6;
+  };
+
+  void queueWrite(uint16_t address, uint8_t value, bool vrc6);
+  void applyWrite(const RegisterWrite &write);
+  // Sends a 2A03 write to the core(s) that decode its address
+  void write2A03(uint16_t address, uint8_t value);
+  uint32_t nextWriteClock() const {
+    return m_writeNext < m_writeCount ? m_writeQueue[m_writeNext].clock
+                                      : UINT32_MAX;
+  }
+  // Applies the queued writes due at or before clock
+  void applyWritesUntil(uint32_t clock);
+  // Moves the writes past a block of blockClocks to the next block
+  void carryWritesOver(uint32_t blockClocks);
+
+  // Picks the render function for the current mode and chip configuration
+  void selectRenderer();
+
+  // Renders with the chip set fixed at compile time (see ChipSet.h)
+  template <RenderMode Mode, bool WithVRC6>
+  int processWith(float *leftOutput, float *rightOutput, int numSamples);
+
+  template <typename Chips>
+  int processSampled(Chips &chips, float *leftOutput, float *rightOutput,
+                     int numSamples);
+  template <typename Chips>
+  int processEventDriven(Chips &chips, float *leftOutput, float *rightOutput,
+                         int numSamples);
+  template <typename Chips>
+  int processBandlimited(Chips &chips, float *leftOutput, float *rightOutput,
+                         int numSamples);
+
+  template <typename Chips> void fastForwardChips(Chips &chips, int numSamples);
+
+  // Event-driven helpers
+  template <typename Chips> void stepToLevelChange(Chips &chips);
+  template <typename Chips>
+  void advanceWithinLevel(Chips &chips, uint32_t cpuClocks);
+  template <typename Chips>
+  void advanceEvents(Chips &chips, uint32_t cpuClocks);
+  template <typename Chips> void refreshLevel(Chips &chips);
+
+  // Feeds the current levels to the Blip_Buffers in use at a frame time
+  void updateBlip(uint32_t time);
+  int numBlipBuffers() const { return m_stereo ? 2 : 1; }
+
+  // Recomputes the mix levels, and the stem levels when stems are enabled
+  template <typename Chips> void mixLevels(Chips &chips);
+  template <typename Chips> void mixStems(Chips &chips);
+  void refreshStemLevels();
+  // Points the stem Blip_Buffers at the main buffer's clock position
+  void syncStemBuffers();
+  // Converts count stem samples, from the held levels or from the stem
+  // Blip_Buffers, into the stem outputs at offset
+  void writeStems(int offset, int count, bool bandlimited);
 
   // NSFPlay cores
   std::unique_ptr<xgm::NES_APU> m_apu1;  // Pulse channels
   std::unique_ptr<xgm::NES_DMC> m_apu2;  // Triangle, Noise, DMC
   std::unique_ptr<xgm::NES_VRC6> m_vrc6; // VRC6 expansion
 
-  // Blip_Buffer for bandlimited synthesis
-  std::unique_ptr<Blip_Buffer> m_blipBuffer;
+  // Note period tables. setTuning() publishes a table through
+  // m_periodTable and counts it in m_tableEpoch; the audio thread takes it
+  // into m_audioTable in loadPeriodTable() and reports the epoch it saw in
+  // m_loadedEpoch. A replaced table is freed once m_loadedEpoch reaches the
+  // epoch that replaced it, so the audio thread can no longer hold it.
+  struct RetiredTable {
+    uint32_t epoch;
+    std::unique_ptr<PeriodTable> table;
+  };
+  std::atomic<const PeriodTable *> m_periodTable{nullptr};
+  std::atomic<uint32_t> m_tableEpoch{0};
+  std::atomic<uint32_t> m_loadedEpoch{0};
+  const PeriodTable *m_audioTable = nullptr;
+  std::unique_ptr<PeriodTable> m_activeTable;
+  std::vector<RetiredTable> m_retiredTables;
+
+  // Audio thread: picks up the latest table
+  void loadPeriodTable();
+
+  // Blip_Buffers for bandlimited synthesis, left and right. In mono only
+  // the left one runs.
+  static constexpr int BLIP_QUALITY = 12; // blip_good_quality
+  std::unique_ptr<Blip_Buffer> m_blipBuffers[2];
+  std::unique_ptr<Blip_Synth<BLIP_QUALITY>> m_blipSynths[2];
 
   // Sample rate and timing
   double m_sampleRate = 44100.0;
@@ -88,6 +259,14 @@ private:
   double m_clocksPerSample = 0.0;
   double m_clockAccumulator = 0.0;
 
+  // Event-driven render state
+  RenderMode m_renderMode = RenderMode::BANDLIMITED;
+  using ProcessFn = int (NessyAPU::*)(float *, float *, int);
+  ProcessFn m_processFn = nullptr; // Set by selectRenderer()
+  int32_t m_level[2] = {0, 0};       // Mixed output since the last change
+  uint32_t m_clocksUntilChange = 1;  // Clocks until the next level change
+  bool m_levelDirty = true;          // Registers written since last mix
+
   // Channel state
   bool m_channelEnabled[NUM_CHANNELS] = {true,  true,  true,  true,
                                          false, false, false, false};
@@ -98,7 +277,29 @@ private:
   bool m_noiseShortMode = false;
   bool m_vrc6Enabled = false;
 
+  // Channel pans, and whether any is off centre
+  float m_pan[NUM_CHANNELS] = {};
+  bool m_stereo = false;
+
+  // Stem buffers and levels while stems are enabled, and the outputs of the
+  // process() call in progress
+  std::unique_ptr<Stems> m_stems;
+  bool m_stemNonlinear = true;
+  float *const *m_stemOutputs = nullptr;
+
+  // Timestamped register writes, applied from m_writeNext on
+  static constexpr int WRITE_QUEUE_SIZE = 1024;
+  RegisterWrite m_writeQueue[WRITE_QUEUE_SIZE];
+  int m_writeCount = 0;
+  int m_writeNext = 0;
+  uint32_t m_eventClock = 0; // Timestamp for writes made now
+
+  // Float conversion, clipping and output gain for every render mode
+  OutputStage m_output;
+
   // Temporary buffer for Blip_Buffer output
   static constexpr int TEMP_BUFFER_SIZE = 4096;
-  int16_t m_tempBuffer[TEMP_BUFFER_SIZE];
+  int16_t m_tempBuffer[2][TEMP_BUFFER_SIZE];
+  uint32_t m_clockSchedule[TEMP_BUFFER_SIZE]; // CPU clocks per sample
+  int32_t m_mixBuffer[TEMP_BUFFER_SIZE * 2];  // Interleaved chip mix
 };
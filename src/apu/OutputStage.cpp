@@ -0,0 +1,188 @@
+// OutputStage: Chip levels to float output with gain in one vector pass
+// GPL-3.0
+
+#include "OutputStage.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) ||                                    \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NESSY_OUTPUT_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NESSY_OUTPUT_NEON 1
+#endif
+
+namespace {
+
+// Chip levels as floats, one at a time or four at a time
+
+struct Int32Levels {
+  const int32_t *levels;
+  int stride; // 1, or 2 for one channel of an interleaved mix
+
+  float scalar(int i) const {
+    return static_cast<float>(levels[i * stride]);
+  }
+#if NESSY_OUTPUT_SSE2
+  __m128 vector(int i) const {
+    const int32_t *p = levels + i * stride;
+    if (stride == 1)
+      return _mm_cvtepi32_ps(
+          _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    const __m128 a = _mm_castsi128_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)));
+    const __m128 b = _mm_castsi128_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4)));
+    const __m128 even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+    return _mm_cvtepi32_ps(_mm_castps_si128(even));
+  }
+#elif NESSY_OUTPUT_NEON
+  float32x4_t vector(int i) const {
+    const int32_t *p = levels + i * stride;
+    if (stride == 1)
+      return vcvtq_f32_s32(vld1q_s32(p));
+    return vcvtq_f32_s32(vld2q_s32(p).val[0]);
+  }
+#endif
+};
+
+struct Int16Levels {
+  const int16_t *levels;
+
+  float scalar(int i) const { return static_cast<float>(levels[i]); }
+#if NESSY_OUTPUT_SSE2
+  __m128 vector(int i) const {
+    const __m128i x =
+        _mm_loadl_epi64(reinterpret_cast<const __m128i *>(levels + i));
+    // Sign-extend by moving each sample to the top half and shifting back
+    return _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+  }
+#elif NESSY_OUTPUT_NEON
+  float32x4_t vector(int i) const {
+    return vcvtq_f32_s32(vmovl_s16(vld1_s16(levels + i)));
+  }
+#endif
+};
+
+} // namespace
+
+void OutputStage::prepare(double sampleRate) {
+  m_rampLength = std::max(1, static_cast<int>(sampleRate * RAMP_SECONDS));
+  m_gain = m_target;
+  m_rampRemaining = 0;
+}
+
+void OutputStage::setGain(float gain, bool smooth) {
+  if (!smooth) {
+    m_gain = m_target = gain;
+    m_rampRemaining = 0;
+    return;
+  }
+  if (gain == m_target)
+    return;
+  m_target = gain;
+  m_rampRemaining = m_rampLength;
+  m_step = (m_target - m_gain) / static_cast<float>(m_rampLength);
+}
+
+void OutputStage::write(const int32_t *levels, int stride, float scale,
+                        float *left, float *right, int numSamples) {
+  const Int32Levels load{levels, stride};
+  writeRamped<false>(load, load, scale, left, right, numSamples);
+}
+
+void OutputStage::write(const int16_t *levels, float scale, float *left,
+                        float *right, int numSamples) {
+  const Int16Levels load{levels};
+  writeRamped<false>(load, load, scale, left, right, numSamples);
+}
+
+void OutputStage::write(const int32_t *leftLevels, const int32_t *rightLevels,
+                        int stride, float scale, float *left, float *right,
+                        int numSamples) {
+  writeRamped<true>(Int32Levels{leftLevels, stride},
+                    Int32Levels{rightLevels, stride}, scale, left, right,
+                    numSamples);
+}
+
+void OutputStage::write(const int16_t *leftLevels, const int16_t *rightLevels,
+                        float scale, float *left, float *right,
+                        int numSamples) {
+  writeRamped<true>(Int16Levels{leftLevels}, Int16Levels{rightLevels}, scale,
+                    left, right, numSamples);
+}
+
+template <bool Stereo, typename Load>
+void OutputStage::writeRamped(Load loadLeft, Load loadRight, float scale,
+                              float *left, float *right, int numSamples) {
+  int done = 0;
+  if (m_rampRemaining > 0) {
+    done = std::min(numSamples, m_rampRemaining);
+    writeRun<Stereo>(loadLeft, loadRight, scale, m_step, left, right, 0,
+                     done);
+    m_rampRemaining -= done;
+    m_gain = m_rampRemaining > 0 ? m_gain + m_step * static_cast<float>(done)
+                                 : m_target;
+  }
+  writeRun<Stereo>(loadLeft, loadRight, scale, 0.0f, left, right, done,
+                   numSamples);
+}
+
+template <bool Stereo, typename Load>
+void OutputStage::writeRun(Load loadLeft, Load loadRight, float scale,
+                           float step, float *left, float *right, int begin,
+                           int end) {
+  // Sample i gets gain m_gain + step * (i - begin); in mono loadRight is
+  // never read and both outputs get the left channel
+  int i = begin;
+#if NESSY_OUTPUT_SSE2
+  const __m128 vScale = _mm_set1_ps(scale);
+  const __m128 vMin = _mm_set1_ps(-1.0f);
+  const __m128 vMax = _mm_set1_ps(1.0f);
+  const __m128 vGain = _mm_set1_ps(m_gain);
+  const __m128 vStep = _mm_set1_ps(step);
+  __m128 vIndex = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+  for (; i + 4 <= end; i += 4) {
+    const __m128 gain = _mm_add_ps(vGain, _mm_mul_ps(vStep, vIndex));
+    __m128 x = _mm_mul_ps(loadLeft.vector(i), vScale);
+    x = _mm_mul_ps(_mm_min_ps(_mm_max_ps(x, vMin), vMax), gain);
+    _mm_storeu_ps(left + i, x);
+    if (Stereo) {
+      x = _mm_mul_ps(loadRight.vector(i), vScale);
+      x = _mm_mul_ps(_mm_min_ps(_mm_max_ps(x, vMin), vMax), gain);
+    }
+    _mm_storeu_ps(right + i, x);
+    vIndex = _mm_add_ps(vIndex, _mm_set1_ps(4.0f));
+  }
+#elif NESSY_OUTPUT_NEON
+  const float32x4_t vMin = vdupq_n_f32(-1.0f);
+  const float32x4_t vMax = vdupq_n_f32(1.0f);
+  const float32x4_t vGain = vdupq_n_f32(m_gain);
+  const float32x4_t vStep = vdupq_n_f32(step);
+  const float indices[4] = {0.0f, 1.0f, 2.0f, 3.0f};
+  float32x4_t vIndex = vld1q_f32(indices);
+  for (; i + 4 <= end; i += 4) {
+    const float32x4_t gain = vaddq_f32(vGain, vmulq_f32(vStep, vIndex));
+    float32x4_t x = vmulq_n_f32(loadLeft.vector(i), scale);
+    x = vmulq_f32(vminq_f32(vmaxq_f32(x, vMin), vMax), gain);
+    vst1q_f32(left + i, x);
+    if (Stereo) {
+      x = vmulq_n_f32(loadRight.vector(i), scale);
+      x = vmulq_f32(vminq_f32(vmaxq_f32(x, vMin), vMax), gain);
+    }
+    vst1q_f32(right + i, x);
+    vIndex = vaddq_f32(vIndex, vdupq_n_f32(4.0f));
+  }
+#endif
+  for (; i < end; ++i) {
+    const float gain = m_gain + step * static_cast<float>(i - begin);
+    const float x = std::clamp(loadLeft.scalar(i) * scale, -1.0f, 1.0f);
+    left[i] = x * gain;
+    if (Stereo)
+      right[i] = std::clamp(loadRight.scalar(i) * scale, -1.0f, 1.0f) * gain;
+    else
+      right[i] = left[i];
+  }
+}
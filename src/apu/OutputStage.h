@@ -0,0 +1,53 @@
+#pragma once
+
+// OutputStage: Chip levels to float output with gain in one vector pass
+// GPL-3.0
+
+#include <cstdint>
+
+// The last step of NessyAPU::process(): scales a block of integer chip
+// levels to float, clips to [-1, 1], applies the output gain and stores the
+// result to the two output channels, one SIMD pass over the block (SSE2 or
+// NEON where available). Gain changes ramp linearly over RAMP_SECONDS so a
+// moving volume control does not zipper.
+class OutputStage {
+public:
+  static constexpr double RAMP_SECONDS = 0.02;
+
+  // Sets the ramp length; the gain jumps to its target
+  void prepare(double sampleRate);
+
+  // Gain for the following blocks. With smooth set it ramps there from the
+  // current gain, otherwise it applies from the next sample.
+  void setGain(float gain, bool smooth = true);
+  float getGain() const { return m_target; }
+
+  // left[i] = right[i] = clip(levels[i * stride] * scale) * gain
+  void write(const int32_t *levels, int stride, float scale, float *left,
+             float *right, int numSamples);
+  void write(const int16_t *levels, float scale, float *left, float *right,
+             int numSamples);
+
+  // The same with separate left and right levels
+  void write(const int32_t *leftLevels, const int32_t *rightLevels,
+             int stride, float scale, float *left, float *right,
+             int numSamples);
+  void write(const int16_t *leftLevels, const int16_t *rightLevels,
+             float scale, float *left, float *right, int numSamples);
+
+private:
+  // Writes with the gain starting at m_gain and moving by step per sample
+  template <bool Stereo, typename Load>
+  void writeRun(Load loadLeft, Load loadRight, float scale, float step,
+                float *left, float *right, int begin, int end);
+
+  template <bool Stereo, typename Load>
+  void writeRamped(Load loadLeft, Load loadRight, float scale, float *left,
+                   float *right, int numSamples);
+
+  float m_gain = 1.0f;
+  float m_target = 1.0f;
+  float m_step = 0.0f;
+  int m_rampRemaining = 0;
+  int m_rampLength = 1;
+};
@@ -0,0 +1,73 @@
+// PeriodTable: Precomputed MIDI note to chip divider period tables
+// GPL-3.0
+
+#include "PeriodTable.h"
+
+#include <algorithm>
+#include <cmath>
+
+// MIDI note 69 = A4
+static constexpr int MIDI_A4 = 69;
+
+// Cents each pitch class (counted up from the root) deviates from
+// equal temperament
+static constexpr double TEMPERAMENT_CENTS
+    [static_cast<int>(PeriodTable::Temperament::NUM_TEMPERAMENTS)][12] = {
+        // EQUAL
+        {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+        // JUST: 1/1 16/15 9/8 6/5 5/4 4/3 45/32 3/2 8/5 5/3 9/5 15/8
+        {0.0, 11.73, 3.91, 15.64, -13.69, -1.96, -9.78, 1.96, 13.69, -15.64,
+         17.60, -11.73},
+        // PYTHAGOREAN: stacked 3/2 fifths
+        {0.0, -9.78, 3.91, -5.87, 7.82, -1.96, 11.73, 1.96, -7.82, 5.87,
+         -3.91, 9.78},
+        // MEANTONE: fifths narrowed by a quarter syntonic comma
+        {0.0, -23.95, -6.84, 10.26, -13.69, 3.42, -20.53, -3.42, -27.37,
+         -10.26, 6.84, -17.11},
+        // WERCKMEISTER3
+        {0.0, -9.78, -7.82, -5.87, -9.78, -1.96, -11.73, -3.91, -7.82,
+         -11.73, -3.91, -7.82},
+};
+
+// Period ranges of the timer registers
+static constexpr double MAX_PERIOD_2A03 = 2047.0;
+static constexpr double MAX_PERIOD_VRC6 = 4095.0;
+
+bool PeriodTable::Tuning::operator==(const Tuning &other) const {
+  return referenceA4 == other.referenceA4 &&
+         detuneCents == other.detuneCents &&
+         temperament == other.temperament && root == other.root;
+}
+
+PeriodTable::PeriodTable(const Tuning &tuning, double clockRate)
+    : m_tuning(tuning) {
+  const double *cents = TEMPERAMENT_CENTS[std::clamp(
+      static_cast<int>(tuning.temperament), 0,
+      static_cast<int>(Temperament::NUM_TEMPERAMENTS) - 1)];
+  const int root = ((tuning.root % 12) + 12) % 12;
+  auto pitchClass = [root](int note) { return (note - root + 12) % 12; };
+
+  // The reference A4 keeps its pitch whatever the temperament
+  const double offsetA4 = cents[pitchClass(MIDI_A4)];
+
+  static constexpr double STEPS[NUM_DIVIDERS] = {16.0, 32.0, 16.0, 14.0};
+  static constexpr double MAX_PERIOD[NUM_DIVIDERS] = {
+      MAX_PERIOD_2A03, MAX_PERIOD_2A03, MAX_PERIOD_VRC6, MAX_PERIOD_VRC6};
+
+  for (int note = 0; note < NUM_NOTES; ++note) {
+    const double noteCents =
+        cents[pitchClass(note)] - offsetA4 + tuning.detuneCents;
+    const double semitones = (note - MIDI_A4) + noteCents / 100.0;
+    const double freq = tuning.referenceA4 * std::pow(2.0, semitones / 12.0);
+    m_frequency[note] = freq;
+
+    for (int d = 0; d < NUM_DIVIDERS; ++d) {
+      const double period = (clockRate / (STEPS[d] * freq)) - 1.0;
+      m_period[d][note] =
+          static_cast<uint16_t>(std::clamp(period, 0.0, MAX_PERIOD[d]));
+    }
+
+    m_noisePeriod[note] =
+        static_cast<uint8_t>(std::clamp(15 - note / 8, 0, 15));
+  }
+}
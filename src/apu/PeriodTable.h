@@ -0,0 +1,71 @@
+#pragma once
+
+// PeriodTable: Precomputed MIDI note to chip divider period tables
+// GPL-3.0
+
+#include <cstdint>
+
+class PeriodTable {
+public:
+  // Tuning systems, built on the root pitch class of Tuning
+  enum class Temperament {
+    EQUAL,         // 12-tone equal temperament
+    JUST,          // 5-limit just intonation
+    PYTHAGOREAN,   // Pure fifths
+    MEANTONE,      // Quarter-comma meantone
+    WERCKMEISTER3, // Werckmeister III well temperament
+    NUM_TEMPERAMENTS
+  };
+
+  struct Tuning {
+    double referenceA4 = 440.0; // Hz
+    double detuneCents = 0.0;   // Applied to every note
+    Temperament temperament = Temperament::EQUAL;
+    int root = 0; // Pitch class the temperament is built on (0 = C)
+
+    bool operator==(const Tuning &other) const;
+    bool operator!=(const Tuning &other) const { return !(*this == other); }
+  };
+
+  // Chip dividers that turn a timer period into a pitch
+  enum Divider {
+    PULSE_2A03 = 0, // 16 steps, 11-bit period
+    TRIANGLE_2A03,  // 32 steps, 11-bit period
+    PULSE_VRC6,     // 16 steps, 12-bit period
+    SAW_VRC6,       // 14 steps, 12-bit period
+    NUM_DIVIDERS
+  };
+
+  static constexpr int NUM_NOTES = 128;
+
+  // Builds every table. Uses std::pow, so call off the audio thread.
+  PeriodTable(const Tuning &tuning, double clockRate);
+
+  uint16_t getPeriod(Divider divider, int midiNote) const {
+    return m_period[divider][clampNote(midiNote)];
+  }
+
+  // 2A03 noise period index (0-15), higher notes pick faster noise
+  uint8_t getNoisePeriod(int midiNote) const {
+    return m_noisePeriod[clampNote(midiNote)];
+  }
+
+  // Tuned pitch of a note in Hz
+  double getFrequency(int midiNote) const {
+    return m_frequency[clampNote(midiNote)];
+  }
+
+  const Tuning &getTuning() const { return m_tuning; }
+
+private:
+  static int clampNote(int midiNote) {
+    if (midiNote < 0)
+      return 0;
+    return midiNote < NUM_NOTES ? midiNote : NUM_NOTES - 1;
+  }
+
+  Tuning m_tuning;
+  uint16_t m_period[NUM_DIVIDERS][NUM_NOTES];
+  uint8_t m_noisePeriod[NUM_NOTES];
+  double m_frequency[NUM_NOTES];
+};
@@ -0,0 +1,170 @@
+// RealtimeWorkerPool: Fans a small batch of jobs out from the audio thread
+// GPL-3.0
+
+#include "RealtimeWorkerPool.h"
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <mach/mach_time.h>
+#include <mach/thread_policy.h>
+#include <pthread.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Polls before an idle worker goes to sleep. Audio blocks arrive every few
+// milliseconds, so a worker usually sleeps between them and the wake-up is
+// the latency that matters; the spin only covers back-to-back batches.
+static constexpr int SPIN_POLLS = 2000;
+
+// Moves the calling worker out of the normal scheduling class, so ordinary
+// threads cannot preempt it while run() waits on its job. Returns false
+// when the system refuses (Linux without an RLIMIT_RTPRIO grant or
+// CAP_SYS_NICE), and the worker carries on at its default priority.
+static bool raiseWorkerPriority() {
+#if defined(_WIN32)
+  return SetThreadPriority(GetCurrentThread(),
+                           THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#elif defined(__APPLE__)
+  // A time-constraint thread, like the host's audio threads: up to 1 ms of
+  // work within each 2 ms
+  mach_timebase_info_data_t timebase;
+  mach_timebase_info(&timebase);
+  const double ticksPerMs = 1.0e6 * timebase.denom / timebase.numer;
+  thread_time_constraint_policy_data_t policy;
+  policy.period = 0;
+  policy.computation = static_cast<uint32_t>(ticksPerMs);
+  policy.constraint = static_cast<uint32_t>(2.0 * ticksPerMs);
+  policy.preemptible = 1;
+  return thread_policy_set(pthread_mach_thread_np(pthread_self()),
+                           THREAD_TIME_CONSTRAINT_POLICY,
+                           reinterpret_cast<thread_policy_t>(&policy),
+                           THREAD_TIME_CONSTRAINT_POLICY_COUNT) ==
+         KERN_SUCCESS;
+#else
+  // The lowest FIFO priority is enough to keep normal threads off, and
+  // stays under the audio thread, which a spinning worker must not starve
+  sched_param param{};
+  param.sched_priority = sched_get_priority_min(SCHED_FIFO);
+  return pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) == 0;
+#endif
+}
+
+RealtimeWorkerPool::RealtimeWorkerPool(int numWorkers) {
+  reserveWorkers(numWorkers);
+}
+
+RealtimeWorkerPool &RealtimeWorkerPool::shared() {
+  static RealtimeWorkerPool pool;
+  return pool;
+}
+
+void RealtimeWorkerPool::reserveWorkers(int numWorkers) {
+  if (getNumWorkers() >= numWorkers)
+    return;
+
+  std::lock_guard<std::mutex> guard(m_startLock);
+  while (static_cast<int>(m_threads.size()) < numWorkers) {
+    m_threads.emplace_back([this] {
+      if (!raiseWorkerPriority())
+        m_unprioritized.fetch_add(1, std::memory_order_relaxed);
+      workerLoop();
+    });
+    m_numWorkers.store(static_cast<int>(m_threads.size()),
+                       std::memory_order_release);
+  }
+}
+
+RealtimeWorkerPool::~RealtimeWorkerPool() {
+  {
+    std::lock_guard<std::mutex> guard(m_sleepLock);
+    m_quit.store(true);
+  }
+  m_wake.notify_all();
+  for (auto &thread : m_threads)
+    thread.join();
+}
+
+void RealtimeWorkerPool::run(Job job, void *context, int numJobs) {
+  if (numJobs <= 0)
+    return;
+
+  if (getNumWorkers() == 0 || numJobs == 1 ||
+      m_busy.exchange(true, std::memory_order_acquire)) {
+    for (int i = 0; i < numJobs; ++i)
+      job(context, i);
+    return;
+  }
+
+  // Every claim of the previous batch has finished, so nothing reads these
+  m_job = job;
+  m_context = context;
+  m_done.store(0, std::memory_order_relaxed);
+
+  ++m_generation;
+  m_work.store((static_cast<uint64_t>(m_generation) << 32) |
+                   (static_cast<uint64_t>(numJobs) << 16),
+               std::memory_order_release);
+
+  // Without the lock, so the audio thread never blocks on a sleeping worker
+  m_wake.notify_all();
+
+  runJobs(m_generation);
+  while (m_done.load(std::memory_order_acquire) < numJobs)
+    std::this_thread::yield();
+  m_busy.store(false, std::memory_order_release);
+}
+
+void RealtimeWorkerPool::runJobs(uint32_t generation) {
+  uint64_t work = m_work.load(std::memory_order_acquire);
+  for (;;) {
+    if (generationOf(work) != generation || nextOf(work) >= countOf(work))
+      return;
+    if (!m_work.compare_exchange_weak(work, work + 1,
+                                      std::memory_order_acq_rel,
+                                      std::memory_order_acquire))
+      continue;
+
+    m_job(m_context, nextOf(work));
+    m_done.fetch_add(1, std::memory_order_release);
+    work = m_work.load(std::memory_order_acquire);
+  }
+}
+
+void RealtimeWorkerPool::workerLoop() {
+  uint32_t seen = 0;
+  for (;;) {
+    auto hasNewBatch = [this, &seen] {
+      return generationOf(m_work.load(std::memory_order_acquire)) != seen;
+    };
+
+    bool ready = false;
+    for (int i = 0; i < SPIN_POLLS && !ready; ++i) {
+      ready = hasNewBatch() || m_quit.load(std::memory_order_relaxed);
+      if (!ready)
+        std::this_thread::yield();
+    }
+
+    if (!ready) {
+      std::unique_lock<std::mutex> lock(m_sleepLock);
+      // A wake-up that races with this wait is lost, and the worker sits
+      // out that batch until the next one wakes it
+      m_wake.wait(lock, [this, &hasNewBatch] {
+        return hasNewBatch() || m_quit.load();
+      });
+    }
+
+    if (m_quit.load())
+      return;
+    if (!hasNewBatch())
+      continue;
+
+    seen = generationOf(m_work.load(std::memory_order_acquire));
+    runJobs(seen);
+  }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+// RealtimeWorkerPool: Fans a small batch of jobs out from the audio thread
+// GPL-3.0
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads are started ahead of the batches and wait between them.
+// run() takes no locks and allocates nothing: it publishes the batch with one
+// atomic store, wakes the workers, claims jobs itself like any worker and
+// spins until the jobs the workers claimed have finished. A worker that
+// misses the wake-up only costs parallelism, never a stall, because the
+// calling thread runs whatever is left unclaimed.
+//
+// That spin has no bound of its own: it lasts as long as the slowest claimed
+// job. Workers therefore run at realtime priority (time-critical on
+// Windows, a time-constraint thread on macOS, SCHED_FIFO elsewhere) so that
+// ordinary threads cannot preempt one mid-job. Where the system refuses,
+// getNumUnprioritized() counts the workers left at normal priority, and a
+// preempted one holds up run() until it is scheduled again.
+class RealtimeWorkerPool {
+public:
+  using Job = void (*)(void *context, int index);
+
+  // numWorkers threads in addition to the calling thread
+  explicit RealtimeWorkerPool(int numWorkers = 0);
+  ~RealtimeWorkerPool();
+
+  RealtimeWorkerPool(const RealtimeWorkerPool &) = delete;
+  RealtimeWorkerPool &operator=(const RealtimeWorkerPool &) = delete;
+
+  // The process-wide pool, which starts without workers. Sharing it keeps
+  // several plugin instances from each spinning their own threads.
+  static RealtimeWorkerPool &shared();
+
+  // Starts workers until there are at least numWorkers. Starting a thread
+  // is not realtime-safe; once there are enough this only reads a counter.
+  void reserveWorkers(int numWorkers);
+
+  int getNumWorkers() const {
+    return m_numWorkers.load(std::memory_order_acquire);
+  }
+
+  // Workers the system would not give realtime priority
+  int getNumUnprioritized() const {
+    return m_unprioritized.load(std::memory_order_relaxed);
+  }
+
+  // Runs job(context, i) for every i in [0, numJobs) and returns once all
+  // of them have finished. While another thread's batch is running, the
+  // jobs run on the calling thread instead.
+  void run(Job job, void *context, int numJobs);
+
+private:
+  // m_work packs the batch generation, the job count and the next unclaimed
+  // job, so a claim can never mix up two batches
+  static uint32_t generationOf(uint64_t work) {
+    return static_cast<uint32_t>(work >> 32);
+  }
+  static int countOf(uint64_t work) {
+    return static_cast<int>((work >> 16) & 0xFFFF);
+  }
+  static int nextOf(uint64_t work) { return static_cast<int>(work & 0xFFFF); }
+
+  void workerLoop();
+
+  // Runs jobs of batch 'generation' until none are left unclaimed
+  void runJobs(uint32_t generation);
+
+  std::vector<std::thread> m_threads; // Guarded by m_startLock
+  std::mutex m_startLock;
+  std::atomic<int> m_numWorkers{0};
+  std::atomic<int> m_unprioritized{0};
+
+  // Held by the thread whose batch is running
+  std::atomic<bool> m_busy{false};
+
+  std::atomic<uint64_t> m_work{0};
+  std::atomic<int> m_done{0};
+  std::atomic<bool> m_quit{false};
+  uint32_t m_generation = 0;
+
+  // Written by run() before the batch is published
+  Job m_job = nullptr;
+  void *m_context = nullptr;
+
+  // Idle workers sleep here once they have spun for a while
+  std::mutex m_sleepLock;
+  std::condition_variable m_wake;
+};
@@ -4,13 +4,66 @@
 #include "VoiceAllocator.h"
 #include "NessyAPU.h"
 
+#include <algorithm>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Index of the lowest set bit of a non-zero voice mask
+static int lowestVoice(uint64_t mask) {
+#if defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward64(&index, mask);
+  return static_cast<int>(index);
+#else
+  return __builtin_ctzll(mask);
+#endif
+}
+
+static uint64_t voiceBit(int voice) { return uint64_t(1) << voice; }
+
+static bool isValidNote(int midiChannel, int noteNumber) {
+  return midiChannel >= 0 &&
+         midiChannel < VoiceAllocator::NUM_MIDI_CHANNELS && noteNumber >= 0 &&
+         noteNumber < VoiceAllocator::NUM_NOTES;
+}
+
 VoiceAllocator::VoiceAllocator() { allNotesOff(); }
 
+void VoiceAllocator::setAPUs(NessyAPU *const *apus, int numAPUs) {
+  m_numAPUs = std::clamp(numAPUs, 0, MAX_CHIPS);
+  for (int i = 0; i < MAX_CHIPS; ++i)
+    m_apus[i] = i < m_numAPUs ? apus[i] : nullptr;
+  m_numChips = std::clamp(m_numChips, 1, std::max(1, m_numAPUs));
+}
+
+void VoiceAllocator::setNumChips(int numChips) {
+  numChips = std::clamp(numChips, 1, std::max(1, m_numAPUs));
+
+  // Chips that drop out stop sounding rather than holding their notes
+  for (int v = voiceIndex(numChips, 0); v < voiceIndex(m_numChips, 0); ++v)
+    if (m_voices[v].noteNumber >= 0)
+      releaseVoice(v);
+  m_numChips = numChips;
+}
+
+void VoiceAllocator::setChannelGroup(int midiChannel, uint8_t channelMask) {
+  if (midiChannel >= 0 && midiChannel < NUM_MIDI_CHANNELS)
+    m_channelGroups[midiChannel] = channelMask & ~(1 << NessyAPU::DMC);
+}
+
+uint8_t VoiceAllocator::getChannelGroup(int midiChannel) const {
+  if (midiChannel < 0 || midiChannel >= NUM_MIDI_CHANNELS)
+    return 0;
+  return m_channelGroups[midiChannel];
+}
+
 void VoiceAllocator::noteOn(int midiChannel, int noteNumber, float velocity) {
-  if (!m_apu)
+  if (!m_apus[0] || !isValidNote(midiChannel, noteNumber))
     return;
 
-  // UNISON mode: trigger multiple channels at once
+  // UNISON mode: trigger multiple channels of one chip at once
   if (m_mode == Mode::UNISON) {
     // Always use P1 + P2 for unison (both pulses)
     int unisonChannels[] = {NessyAPU::PULSE1, NessyAPU::PULSE2};
@@ -25,45 +78,38 @@ void VoiceAllocator::noteOn(int midiChannel, int noteNumber, float velocity) {
 
     int *channels = m_vrc6Enabled ? unisonWithVRC6 : unisonChannels;
 
-    for (int i = 0; i < numUnison; ++i) {
-      int ch = channels[i];
-      // Turn off existing note
-      if (m_voices[ch].noteNumber >= 0) {
-        m_apu->noteOff(ch);
-      }
-      m_voices[ch].noteNumber = noteNumber;
-      m_voices[ch].velocity = velocity;
-      m_voices[ch].timestamp = ++m_timestamp;
-      m_apu->noteOn(ch, noteNumber, velocity);
-    }
+    // Each chip in the stack plays one unison note
+    const int chip = findChipForUnison(midiChannel, noteNumber);
+    for (int i = 0; i < numUnison; ++i)
+      startVoice(voiceIndex(chip, channels[i]), midiChannel, noteNumber,
+                 velocity);
     return;
   }
 
   // Non-unison modes: single channel allocation
-  int nesChannel = -1;
+  int voice = -1;
 
   switch (m_mode) {
   case Mode::ROUND_ROBIN: {
     // Check if note already playing
-    for (int i = 0; i < getMaxChannels(); ++i) {
-      int ch = m_channelOrder[i];
-      if (m_voices[ch].noteNumber == noteNumber) {
-        nesChannel = ch;
-        break;
-      }
-    }
-    // Find free channel using priority order
-    if (nesChannel < 0)
-      nesChannel = findFreeChannel();
-    // Steal oldest if all channels full
-    if (nesChannel < 0)
-      nesChannel = findOldestChannel();
+    if (m_noteVoices[midiChannel][noteNumber] != 0)
+      voice = lowestVoice(m_noteVoices[midiChannel][noteNumber]);
+    // Find free channel using priority order, stealing the oldest if all
+    // channels are full
+    if (voice < 0)
+      voice = findVoice(m_channelOrder.data(), getMaxChannels());
     break;
   }
 
   case Mode::PITCH_SPLIT: {
     // Route based on pitch
-    nesChannel = findChannelForPitch(noteNumber);
+    voice = findVoiceForPitch(noteNumber);
+    break;
+  }
+
+  case Mode::MULTITIMBRAL: {
+    // Route based on MIDI channel
+    voice = findVoiceInGroup(midiChannel);
     break;
   }
 
@@ -72,150 +118,131 @@ void VoiceAllocator::noteOn(int midiChannel, int noteNumber, float velocity) {
     break;
   }
 
-  if (nesChannel >= 0 && nesChannel < NUM_TOTAL_VOICES) {
-    // Turn off existing note on this channel
-    if (m_voices[nesChannel].noteNumber >= 0) {
-      m_apu->noteOff(nesChannel);
-    }
-
-    m_voices[nesChannel].noteNumber = noteNumber;
-    m_voices[nesChannel].velocity = velocity;
-    m_voices[nesChannel].timestamp = ++m_timestamp;
-
-    m_apu->noteOn(nesChannel, noteNumber, velocity);
-  }
+  if (voice >= 0)
+    startVoice(voice, midiChannel, noteNumber, velocity);
 }
 
 void VoiceAllocator::noteOff(int midiChannel, int noteNumber) {
-  if (!m_apu)
+  if (!m_apus[0] || !isValidNote(midiChannel, noteNumber))
     return;
 
-  for (int i = 0; i < NUM_TOTAL_VOICES; ++i) {
-    if (m_voices[i].noteNumber == noteNumber) {
-      m_voices[i].noteNumber = -1;
-      m_voices[i].velocity = 0.0f;
-      m_apu->noteOff(i);
-    }
-  }
+  uint64_t voices = m_noteVoices[midiChannel][noteNumber];
+  for (; voices != 0; voices &= voices - 1)
+    releaseVoice(lowestVoice(voices));
 }
 
 void VoiceAllocator::allNotesOff() {
-  for (int i = 0; i < NUM_TOTAL_VOICES; ++i) {
-    m_voices[i].noteNumber = -1;
-    m_voices[i].velocity = 0.0f;
-    if (m_apu)
-      m_apu->noteOff(i);
+  for (int v = 0; v < MAX_VOICES; ++v) {
+    m_voices[v].noteNumber = -1;
+    m_voices[v].velocity = 0.0f;
+    if (m_apus[chipOf(v)])
+      m_apus[chipOf(v)]->noteOff(channelOf(v));
   }
+  for (auto &notes : m_noteVoices)
+    std::fill(std::begin(notes), std::end(notes), 0);
 }
 
-int VoiceAllocator::getChannelForNote(int noteNumber) const {
-  for (int i = 0; i < NUM_TOTAL_VOICES; ++i) {
-    if (m_voices[i].noteNumber == noteNumber)
-      return i;
-  }
-  return -1;
+int VoiceAllocator::getChannelForNote(int midiChannel, int noteNumber) const {
+  if (!isValidNote(midiChannel, noteNumber) ||
+      m_noteVoices[midiChannel][noteNumber] == 0)
+    return -1;
+  return channelOf(lowestVoice(m_noteVoices[midiChannel][noteNumber]));
 }
 
-int VoiceAllocator::getMaxChannels() const { return m_vrc6Enabled ? 6 : 3; }
+void VoiceAllocator::startVoice(int voice, int midiChannel, int noteNumber,
+                                float velocity) {
+  NessyAPU *apu = m_apus[chipOf(voice)];
+  Voice &v = m_voices[voice];
 
-int VoiceAllocator::findFreeChannel() const {
-  // Use channel order priority
-  int maxCh = getMaxChannels();
-  for (int i = 0; i < maxCh; ++i) {
-    int ch = m_channelOrder[i];
-    if (m_voices[ch].noteNumber < 0)
-      return ch;
+  // Turn off existing note on this channel
+  if (v.noteNumber >= 0) {
+    m_noteVoices[v.midiChannel][v.noteNumber] &= ~voiceBit(voice);
+    apu->noteOff(channelOf(voice));
   }
-  return -1;
+
+  v.noteNumber = noteNumber;
+  v.midiChannel = midiChannel;
+  v.velocity = velocity;
+  v.timestamp = ++m_timestamp;
+  m_noteVoices[midiChannel][noteNumber] |= voiceBit(voice);
+
+  apu->noteOn(channelOf(voice), noteNumber, velocity);
 }
 
-int VoiceAllocator::findOldestChannel() const {
-  int maxCh = getMaxChannels();
-  if (maxCh == 0)
-    return -1;
+void VoiceAllocator::releaseVoice(int voice) {
+  const Voice &v = m_voices[voice];
+  m_noteVoices[v.midiChannel][v.noteNumber] &= ~voiceBit(voice);
+  m_voices[voice].noteNumber = -1;
+  m_voices[voice].velocity = 0.0f;
+  m_apus[chipOf(voice)]->noteOff(channelOf(voice));
+}
+
+int VoiceAllocator::getMaxChannels() const { return m_vrc6Enabled ? 6 : 3; }
 
-  int oldest = m_channelOrder[0];
-  uint32_t oldestTime = m_voices[oldest].timestamp;
+int VoiceAllocator::findVoice(const int *channels, int numChannels) const {
+  if (numChannels == 0)
+    return -1;
 
-  for (int i = 1; i < maxCh; ++i) {
-    int ch = m_channelOrder[i];
-    if (m_voices[ch].timestamp < oldestTime) {
-      oldest = ch;
-      oldestTime = m_voices[ch].timestamp;
+  int oldest = voiceIndex(0, channels[0]);
+  for (int i = 0; i < numChannels; ++i) {
+    for (int chip = 0; chip < m_numChips; ++chip) {
+      int v = voiceIndex(chip, channels[i]);
+      if (m_voices[v].noteNumber < 0)
+        return v;
+      if (m_voices[v].timestamp < m_voices[oldest].timestamp)
+        oldest = v;
     }
   }
-
   return oldest;
 }
 
-int VoiceAllocator::findChannelForPitch(int noteNumber) const {
+int VoiceAllocator::findVoiceForPitch(int noteNumber) const {
   // Pitch-split: low notes go to bass channels (Triangle, VRC6_SAW)
   // High notes go to pulse channels
   bool isLowNote = noteNumber < m_splitPoint;
 
   if (isLowNote) {
     // Bass channels: Triangle first, then VRC6_SAW if enabled
-    if (m_voices[TRIANGLE].noteNumber < 0)
-      return TRIANGLE;
-    if (m_vrc6Enabled && m_voices[VRC6_SAW].noteNumber < 0)
-      return VRC6_SAW;
-    // If bass channels full, steal oldest bass channel
-    if (m_vrc6Enabled) {
-      return (m_voices[TRIANGLE].timestamp < m_voices[VRC6_SAW].timestamp)
-                 ? TRIANGLE
-                 : VRC6_SAW;
-    }
-    return TRIANGLE;
+    static constexpr int bassChannels[] = {TRIANGLE, VRC6_SAW};
+    return findVoice(bassChannels, m_vrc6Enabled ? 2 : 1);
   } else {
     // High notes: Pulse channels (P1, P2, VRC6_P1, VRC6_P2)
-    if (m_voices[PULSE1].noteNumber < 0)
-      return PULSE1;
-    if (m_voices[PULSE2].noteNumber < 0)
-      return PULSE2;
-    if (m_vrc6Enabled) {
-      if (m_voices[VRC6_PULSE1].noteNumber < 0)
-        return VRC6_PULSE1;
-      if (m_voices[VRC6_PULSE2].noteNumber < 0)
-        return VRC6_PULSE2;
-    }
-    // Steal oldest pulse channel
-    int oldest = PULSE1;
-    uint32_t oldestTime = m_voices[PULSE1].timestamp;
-    if (m_voices[PULSE2].timestamp < oldestTime) {
-      oldest = PULSE2;
-      oldestTime = m_voices[PULSE2].timestamp;
-    }
-    if (m_vrc6Enabled) {
-      if (m_voices[VRC6_PULSE1].timestamp < oldestTime) {
-        oldest = VRC6_PULSE1;
-        oldestTime = m_voices[VRC6_PULSE1].timestamp;
-      }
-      if (m_voices[VRC6_PULSE2].timestamp < oldestTime) {
-        oldest = VRC6_PULSE2;
-      }
-    }
-    return oldest;
+    static constexpr int pulseChannels[] = {PULSE1, PULSE2, VRC6_PULSE1,
+                                            VRC6_PULSE2};
+    return findVoice(pulseChannels, m_vrc6Enabled ? 4 : 2);
   }
 }
 
-int VoiceAllocator::midiChannelToNesChannel(int midiChannel) const {
-  // MIDI channel to NES channel mapping for reference
-  switch (midiChannel) {
-  case 0:
-    return PULSE1;
-  case 1:
-    return PULSE2;
-  case 2:
-    return TRIANGLE;
-  case 4:
-    return m_vrc6Enabled ? VRC6_PULSE1 : PULSE1;
-  case 5:
-    return m_vrc6Enabled ? VRC6_PULSE2 : PULSE2;
-  case 6:
-    return m_vrc6Enabled ? VRC6_SAW : TRIANGLE;
-  case 9:
-    return NOISE;
-  default:
-    return PULSE1;
+int VoiceAllocator::findChipForUnison(int midiChannel, int noteNumber) const {
+  // Retrigger a chip already playing the note
+  if (m_noteVoices[midiChannel][noteNumber] != 0)
+    return chipOf(lowestVoice(m_noteVoices[midiChannel][noteNumber]));
+
+  // Pulse 1 is in every unison stack, so it stands for its chip: take a
+  // free chip or the oldest
+  static constexpr int unisonLead[] = {PULSE1};
+  return chipOf(findVoice(unisonLead, 1));
+}
+
+int VoiceAllocator::findVoiceInGroup(int midiChannel) const {
+  uint8_t group = m_channelGroups[midiChannel];
+
+  // Without VRC6, its channels fall back to their 2A03 counterparts
+  if (!m_vrc6Enabled) {
+    static constexpr int fallback[][2] = {{VRC6_PULSE1, PULSE1},
+                                          {VRC6_PULSE2, PULSE2},
+                                          {VRC6_SAW, TRIANGLE}};
+    for (const auto &[from, to] : fallback) {
+      if (group & (1 << from))
+        group = static_cast<uint8_t>((group & ~(1 << from)) | (1 << to));
+    }
+  }
+
+  int channels[NUM_TOTAL_VOICES];
+  int numChannels = 0;
+  for (int ch = 0; ch < NUM_TOTAL_VOICES; ++ch) {
+    if (group & (1 << ch))
+      channels[numChannels++] = ch;
   }
+  return findVoice(channels, numChannels);
 }
@@ -14,16 +14,33 @@ public:
   enum class Mode {
     ROUND_ROBIN, // Cycle through channels in order
     PITCH_SPLIT, // Low notes → Triangle/Saw, High notes → Pulses
-    UNISON       // Stack multiple channels on same note (fatter sound)
+    UNISON,      // Stack multiple channels on same note (fatter sound)
+    MULTITIMBRAL // Each MIDI channel plays its own channel group
   };
 
+  // Chips a chip stack can spread voices across (see ChipStack)
+  static constexpr int MAX_CHIPS = 8;
+
+  static constexpr int NUM_MIDI_CHANNELS = 16;
+  static constexpr int NUM_NOTES = 128;
+
   VoiceAllocator();
 
-  void setAPU(NessyAPU *apu) { m_apu = apu; }
+  // Single chip
+  void setAPU(NessyAPU *apu) { setAPUs(&apu, 1); }
+
+  // Chip stack: notes go to the first getNumChips() of numAPUs chips
+  void setAPUs(NessyAPU *const *apus, int numAPUs);
+
+  // Active chip count, 1 to the number of APUs. Releases the notes held on
+  // chips that become inactive.
+  void setNumChips(int numChips);
+  int getNumChips() const { return m_numChips; }
+
   void setMode(Mode mode) { m_mode = mode; }
   Mode getMode() const { return m_mode; }
 
-  // VRC6 enable state (extends both modes to 6 voices)
+  // VRC6 enable state (extends both modes to 6 voices per chip)
   void setVRC6Enabled(bool enabled) { m_vrc6Enabled = enabled; }
   bool isVRC6Enabled() const { return m_vrc6Enabled; }
 
@@ -37,13 +54,22 @@ public:
   }
   const std::array<int, 6> &getChannelOrder() const { return m_channelOrder; }
 
+  // Multitimbral routing: the NES channels (a mask of 1 << channel) that a
+  // MIDI channel's notes play on, on every active chip. VRC6 channels fall
+  // back to Pulse 1/2 and Triangle while VRC6 is disabled. The defaults are
+  // P1, P2, Tri, Pulses, VRC6 P1, VRC6 P2, Saw, Pulses, Pulses, Noise and
+  // Pulses for channels 11-16.
+  void setChannelGroup(int midiChannel, uint8_t channelMask);
+  uint8_t getChannelGroup(int midiChannel) const;
+
   // Handle MIDI events
   void noteOn(int midiChannel, int noteNumber, float velocity);
   void noteOff(int midiChannel, int noteNumber);
   void allNotesOff();
 
-  // Get which NES channel is playing a given note (-1 if none)
-  int getChannelForNote(int noteNumber) const;
+  // Get which NES channel is playing a given note (-1 if none), on
+  // whichever chip holds it
+  int getChannelForNote(int midiChannel, int noteNumber) const;
 
   // Channel indices for UI reference
   static constexpr int PULSE1 = 0;
@@ -57,6 +83,7 @@ public:
 private:
   struct Voice {
     int noteNumber = -1;
+    int midiChannel = 0;
     float velocity = 0.0f;
     uint32_t timestamp = 0;
   };
@@ -66,13 +93,29 @@ private:
   static constexpr int NUM_VRC6_MELODIC = 3; // VRC6_P1, VRC6_P2, VRC6_SAW
   static constexpr int NUM_TOTAL_VOICES = 8; // All channels including Noise/DMC
 
-  int findFreeChannel() const;
-  int findOldestChannel() const;
-  int findChannelForPitch(int noteNumber) const;
-  int midiChannelToNesChannel(int midiChannel) const;
+  // Voices are indexed chip * NUM_TOTAL_VOICES + channel
+  static constexpr int MAX_VOICES = MAX_CHIPS * NUM_TOTAL_VOICES;
+
+  static int chipOf(int voice) { return voice / NUM_TOTAL_VOICES; }
+  static int channelOf(int voice) { return voice % NUM_TOTAL_VOICES; }
+  static int voiceIndex(int chip, int channel) {
+    return chip * NUM_TOTAL_VOICES + channel;
+  }
+
+  // First free voice on the given channels of any active chip, else the
+  // oldest. Tries every chip's first channel before any chip's second.
+  int findVoice(const int *channels, int numChannels) const;
+  int findVoiceForPitch(int noteNumber) const;
+  int findChipForUnison(int midiChannel, int noteNumber) const;
+  int findVoiceInGroup(int midiChannel) const;
   int getMaxChannels() const;
 
-  NessyAPU *m_apu = nullptr;
+  void startVoice(int voice, int midiChannel, int noteNumber, float velocity);
+  void releaseVoice(int voice);
+
+  std::array<NessyAPU *, MAX_CHIPS> m_apus{};
+  int m_numAPUs = 0;
+  int m_numChips = 1;
   Mode m_mode = Mode::ROUND_ROBIN;
   bool m_vrc6Enabled = false;
   int m_splitPoint = 60; // C4 - notes below go to Triangle/Saw
@@ -80,6 +123,18 @@ private:
   // Channel allocation order (default: P1, P2, Tri, VRC6_P1, VRC6_P2, VRC6_SAW)
   std::array<int, 6> m_channelOrder = {0, 1, 2, 5, 6, 7};
 
-  std::array<Voice, NUM_TOTAL_VOICES> m_voices;
+  std::array<Voice, MAX_VOICES> m_voices;
+
+  // Voices held by each (MIDI channel, note), one bit per voice index, so
+  // note-offs and lookups need no scan
+  static_assert(MAX_VOICES <= 64, "voice masks are 64 bits wide");
+  uint64_t m_noteVoices[NUM_MIDI_CHANNELS][NUM_NOTES] = {};
+  // Multitimbral channel groups, as documented at setChannelGroup()
+  static constexpr uint8_t PULSES = (1 << PULSE1) | (1 << PULSE2);
+  std::array<uint8_t, NUM_MIDI_CHANNELS> m_channelGroups = {
+      1 << PULSE1,      1 << PULSE2,      1 << TRIANGLE, PULSES,
+      1 << VRC6_PULSE1, 1 << VRC6_PULSE2, 1 << VRC6_SAW, PULSES,
+      PULSES,           1 << NOISE,       PULSES,        PULSES,
+      PULSES,           PULSES,           PULSES,        PULSES};
   uint32_t m_timestamp = 0;
 };
@@ -201,6 +201,23 @@ void Blip_Buffer::remove_samples( blip_nsamp_t count )
     }
 }
 
+void Blip_Buffer::save_state( blip_buffer_state_t* out ) const
+{
+    assert( samples_avail() == 0 );
+    out->offset_       = offset_;
+    out->reader_accum_ = reader_accum_;
+    memcpy( out->buf, &buffer_ [offset_ >> BLIP_BUFFER_ACCURACY], sizeof out->buf );
+}
+
+void Blip_Buffer::load_state( blip_buffer_state_t const& in )
+{
+    clear( false );
+
+    offset_       = in.offset_;
+    reader_accum_ = in.reader_accum_;
+    memcpy( buffer_, in.buf, sizeof in.buf );
+}
+
 // Blip_Synth_
 
 Blip_Synth_Fast_::Blip_Synth_Fast_()
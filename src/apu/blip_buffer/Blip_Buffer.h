@@ -35,6 +35,8 @@ typedef blip_ulong blip_nsamp_t;
 typedef short blip_amplitude_t;
 enum { blip_sample_max = 32767 };
 
+struct blip_buffer_state_t;
+
 class Blip_Buffer {
 public:
     typedef const char* blargg_err_t;
@@ -85,6 +87,11 @@ public:
     // Remove 'count' samples from those waiting to be read
     void remove_samples( blip_nsamp_t count );
 
+    // Save or restore the pending impulse tails and timing, for emulator state
+    // snapshots. Only valid when no samples are waiting to be read.
+    void save_state( blip_buffer_state_t* out ) const;
+    void load_state( blip_buffer_state_t const& in );
+
 // Experimental features
 
     // Count number of clocks needed until 'count' samples will be available.
@@ -166,6 +173,15 @@ private:
     int const blip_widest_impulse_ = 16;
     int const blip_buffer_extra_ = blip_widest_impulse_ + 2;
     int const blip_res = 1 << BLIP_PHASE_BITS;
+
+// Saved state of a Blip_Buffer, see Blip_Buffer::save_state()
+struct blip_buffer_state_t
+{
+    blip_resampled_time_t offset_;
+    blip_long reader_accum_;
+    blip_long buf [blip_buffer_extra_];
+};
+
     class blip_eq_t;
 
     class Blip_Synth_Fast_ {
@@ -221,6 +237,9 @@ public:
     /// this acts like subtracting `dc_amp` from all future calls to update().
     void center_dc(int dc_amp) { impl.last_amp = dc_amp; }
 
+    /// Last amplitude passed to update(), for saving state.
+    int last_amp() const { return impl.last_amp; }
+
     // Update amplitude of waveform at given time. Using this requires a separate
     // Blip_Synth for each waveform.
     // The actual output value (assuming no DC removal) is around
@@ -2,6 +2,7 @@
 // NES 2A03
 //
 #include <assert.h>
+#include <array>
 #include "nes_apu.h"
 #include "nsfplay_math.h"
 
@@ -87,21 +88,28 @@ namespace xgm
 
   }
 
-  INT32 NES_APU::calc_sqr (int i, UINT32 clocks)
+  static const INT16 sqrtbl[4][16] = {
+    {0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
+    {0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0},
+    {1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}
+  };
+
+  // nonlinear mixer, evaluated at compile time
+  static constexpr std::array<INT32, 32> MakeSquareTable()
   {
-    static const INT16 sqrtbl[4][16] = {
-      {0, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-      {0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0},
-      {1, 1, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1}
-    };
+    std::array<INT32, 32> table {};
+    for(int i=1;i<32;i++)
+        table[i]=(INT32)((8192.0*95.88)/(8128.0/i+100));
+    return table;
+  }
 
-    scounter[i] -= clocks;
-    while (scounter[i] < 0)
-    {
-        sphase[i] = (sphase[i] + 1) & 15;
-        scounter[i] += freq[i] + 1;
-    }
+  static constexpr std::array<INT32, 32> square_table = MakeSquareTable();
+  static constexpr INT32 square_linear = square_table[15]; // match linear scale to one full volume square of nonlinear
+
+  INT32 NES_APU::calc_sqr (int i, UINT32 clocks)
+  {
+    sphase[i] = (sphase[i] + count_down_divider(scounter[i], freq[i] + 1, clocks)) & 15;
 
     INT32 ret = 0;
     if (length_counter[i] > 0 &&
@@ -181,19 +189,16 @@ namespace xgm
       return out;
   }
 
-  // 生成される波形の振幅は0-8191
-  UINT32 NES_APU::Render (INT32 b[2])
+  template <bool NONLINEAR>
+  void NES_APU::mix_sqr (const INT32 o[2], INT32 b[2]) const
   {
-    out[0] = (mask & 1) ? 0 : out[0];
-    out[1] = (mask & 2) ? 0 : out[1];
-
     INT32 m[2];
 
-    if(option[OPT_NONLINEAR_MIXER])
+    if constexpr (NONLINEAR)
     {
-        INT32 voltage = square_table[out[0] + out[1]];
-        m[0] = out[0] << 6;
-        m[1] = out[1] << 6;
+        INT32 voltage = square_table[o[0] + o[1]];
+        m[0] = o[0] << 6;
+        m[1] = o[1] << 6;
         INT32 ref = m[0] + m[1];
         if (ref > 0)
         {
@@ -208,8 +213,8 @@ namespace xgm
     }
     else
     {
-        m[0] = (out[0] * square_linear) / 15;
-        m[1] = (out[1] * square_linear) / 15;
+        m[0] = (o[0] * square_linear) / 15;
+        m[1] = (o[1] * square_linear) / 15;
     }
 
     b[0]  = m[0] * sm[0][0];
@@ -219,10 +224,102 @@ namespace xgm
     b[1]  = m[0] * sm[1][0];
     b[1] += m[1] * sm[1][1];
     b[1] >>= 7;
+  }
+
+  // 生成される波形の振幅は0-8191
+  UINT32 NES_APU::Render (INT32 b[2])
+  {
+    (this->*mix_kernel)(b);
+    return 2;
+  }
+
+  template <bool NONLINEAR, bool MASKED>
+  void NES_APU::render_sample (INT32 b[2])
+  {
+    if constexpr (MASKED)
+    {
+        out[0] &= mask_keep[0];
+        out[1] &= mask_keep[1];
+    }
+    mix_sqr<NONLINEAR>(out, b);
+  }
+
+  template <bool NONLINEAR>
+  UINT32 NES_APU::RenderWith (INT32 b[2])
+  {
+    render_sample<NONLINEAR, false>(b);
+    return 2;
+  }
+
+  template UINT32 NES_APU::RenderWith<true> (INT32 b[2]);
+  template UINT32 NES_APU::RenderWith<false> (INT32 b[2]);
+
+  void NES_APU::RenderBlock (INT32* b, UINT32 frames, const UINT32* clocks)
+  {
+    (this->*block_kernel)(b, frames, clocks);
+  }
 
+  UINT32 NES_APU::RenderChannels (INT32* b, bool nonlinear) const
+  {
+    for (int i=0; i < 2; ++i)
+    {
+        const INT32 o = out[i] & mask_keep[i];
+        b[i] = nonlinear ? square_table[o] : (o * square_linear) / 15;
+    }
     return 2;
   }
 
+  template <bool NONLINEAR>
+  void NES_APU::render_block (INT32* b, UINT32 frames, const UINT32* clocks)
+  {
+    // Envelope, sweep and length counters only move on register writes and
+    // frame sequencer steps, which never fall inside a block.
+    // Only the dividers and phases advance, so everything else is hoisted.
+    INT32 counter[2] = { scounter[0], scounter[1] };
+    int phase[2] = { sphase[0], sphase[1] };
+    INT32 period[2];
+    INT32 level[2];
+    const INT16* wave[2];
+    INT32 o[2];
+
+    for (int i=0; i < 2; ++i)
+    {
+        bool audible = mask_keep[i] &&
+                       length_counter[i] > 0 &&
+                       freq[i] >= 8 &&
+                       sfreq[i] < 0x800;
+        period[i] = freq[i] + 1;
+        level[i] = !audible ? 0 :
+                   envelope_disable[i] ? volume[i] : envelope_counter[i];
+        wave[i] = sqrtbl[duty[i]];
+        o[i] = out[i] & mask_keep[i];
+    }
+
+    for (UINT32 f = 0; f < frames; ++f)
+    {
+        if (clocks[f])
+        {
+            for (int i=0; i < 2; ++i)
+            {
+                phase[i] = (phase[i] + count_down_divider(counter[i], period[i], clocks[f])) & 15;
+                o[i] = wave[i][phase[i]] ? level[i] : 0;
+            }
+        }
+
+        INT32 m[2];
+        mix_sqr<NONLINEAR>(o, m);
+        b[2*f]   += m[0];
+        b[2*f+1] += m[1];
+    }
+
+    for (int i=0; i < 2; ++i)
+    {
+        scounter[i] = counter[i];
+        sphase[i] = phase[i];
+        out[i] = o[i];
+    }
+  }
+
   NES_APU::NES_APU ()
   {
     SetClock (DEFAULT_CLOCK);
@@ -233,15 +330,11 @@ namespace xgm
     option[OPT_DUTY_SWAP] = false;
     option[OPT_NEGATE_SWEEP_INIT] = false;
 
-    square_table[0] = 0;
-    for(int i=1;i<32;i++) 
-        square_table[i]=(INT32)((8192.0*95.88)/(8128.0/i+100));
-
-    square_linear = square_table[15]; // match linear scale to one full volume square of nonlinear
-
     for(int c=0;c<2;++c)
         for(int t=0;t<2;++t)
             sm[c][t] = 128;
+
+    SetMask(0); // Also selects the kernels
   }
 
   NES_APU::~NES_APU ()
@@ -252,7 +345,7 @@ namespace xgm
   {
     int i;
     gclock = 0;
-    mask = 0;
+    SetMask(0);
 
     for (int i=0; i<2; ++i)
     {
@@ -298,7 +391,36 @@ namespace xgm
 
   void NES_APU::SetOption (int id, int val)
   {
-    if(id<OPT_END) option[id] = val;
+    if(id<OPT_END)
+    {
+      option[id] = val;
+      if(id==OPT_NONLINEAR_MIXER)
+        select_kernels();
+    }
+  }
+
+  void NES_APU::select_kernels ()
+  {
+    if (option[OPT_NONLINEAR_MIXER])
+    {
+      mix_kernel = mask ? &NES_APU::render_sample<true, true>
+                        : &NES_APU::render_sample<true, false>;
+      block_kernel = &NES_APU::render_block<true>;
+    }
+    else
+    {
+      mix_kernel = mask ? &NES_APU::render_sample<false, true>
+                        : &NES_APU::render_sample<false, false>;
+      block_kernel = &NES_APU::render_block<false>;
+    }
+  }
+
+  void NES_APU::SetMask (int m)
+  {
+    mask = m;
+    for (int i=0; i < 2; ++i)
+        mask_keep[i] = (mask & (1 << i)) ? 0 : ~0;
+    select_kernels();
   }
 
   void NES_APU::SetClock (double c)
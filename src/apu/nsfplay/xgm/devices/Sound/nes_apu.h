@@ -5,34 +5,12 @@
 
 namespace xgm
 {
-  /** Upper half of APU **/
-  class NES_APU : public ISoundChip
+  /** Emulation state of NES_APU. Plain data, so a snapshot is a memcpy. **/
+  struct NES_APU_State
   {
-  public:
-    enum
-    {
-        OPT_UNMUTE_ON_RESET=0,
-        OPT_PHASE_REFRESH,
-        OPT_NONLINEAR_MIXER,
-        OPT_DUTY_SWAP,
-        OPT_NEGATE_SWEEP_INIT,
-        OPT_END };
-
-    enum
-    { SQR0_MASK = 1, SQR1_MASK = 2, };
-
-  public:
-    int option[OPT_END];        // 各種オプション
-    int mask;
-    INT32 sm[2][2];
-
     UINT32 gclock;
     UINT8 reg[0x20];
     INT32 out[2];
-    double rate, clock;
-
-    INT32 square_table[32];     // nonlinear mixer
-    INT32 square_linear;        // linear mix approximation
 
     int scounter[2];            // frequency divider
     int sphase[2];              // phase counter
@@ -59,9 +37,47 @@ namespace xgm
     int length_counter[2];
 
     bool enable[2];
+  };
+
+  /** Upper half of APU **/
+  class NES_APU : public ISoundChip, public NES_APU_State
+  {
+  public:
+    enum
+    {
+        OPT_UNMUTE_ON_RESET=0,
+        OPT_PHASE_REFRESH,
+        OPT_NONLINEAR_MIXER,
+        OPT_DUTY_SWAP,
+        OPT_NEGATE_SWEEP_INIT,
+        OPT_END };
+
+    enum
+    { SQR0_MASK = 1, SQR1_MASK = 2, };
+
+  public:
+    int option[OPT_END];        // 各種オプション
+    int mask;
+    INT32 mask_keep[2]; // ~0 for a channel SetMask() leaves audible, else 0
+    INT32 sm[2][2];
+
+    double rate, clock;
 
     void sweep_sqr (int ch); // calculates target sweep frequency
     INT32 calc_sqr (int ch, UINT32 clocks);
+    template <bool NONLINEAR>
+    void mix_sqr (const INT32 o[2], INT32 b[2]) const;
+    template <bool NONLINEAR, bool MASKED>
+    void render_sample (INT32 b[2]);
+    template <bool NONLINEAR>
+    void render_block (INT32* b, UINT32 frames, const UINT32* clocks);
+
+    // Render kernels specialized for the current options and mask, so the
+    // render paths never test option[] or mask. Chosen by select_kernels()
+    // in SetOption() and SetMask().
+    void (NES_APU::*mix_kernel) (INT32 b[2]);
+    void (NES_APU::*block_kernel) (INT32* b, UINT32 frames, const UINT32* clocks);
+    void select_kernels ();
     TrackInfoBasic trkinfo[2];
 
   public:
@@ -74,16 +90,31 @@ namespace xgm
 
     void FrameSequence(int s);
 
+    // options, rate and mix settings are configuration, not saved state
+    typedef NES_APU_State State;
+    void SaveState (State& s) const { s = *this; }
+    void LoadState (const State& s) { static_cast<State&>(*this) = s; }
+
     virtual void Reset ();
     virtual void Tick (UINT32 clocks);
     UINT32 ClocksUntilLevelChange() override;
     virtual UINT32 Render (INT32 b[2]);
+    // Render() through the unmasked kernel for a mixer option known at
+    // compile time, for callers that fix the options (see ChipSet). The core
+    // must be configured to match.
+    template <bool NONLINEAR>
+    UINT32 RenderWith (INT32 b[2]);
+    void RenderBlock (INT32* b, UINT32 frames, const UINT32* clocks) override;
+    // Each channel's level alone and unpanned, as Render() would mix it with
+    // the other channels silent, into b[0..1]; returns the channel count.
+    // With nonlinear false the channels go through the linear mixer instead.
+    UINT32 RenderChannels (INT32* b, bool nonlinear) const;
     virtual bool Read (UINT32 adr, UINT32 & val, UINT32 id=0);
     virtual bool Write (UINT32 adr, UINT32 val, UINT32 id=0);
     virtual void SetRate (double rate);
     virtual void SetClock (double clock);
     virtual void SetOption (int id, int b);
-    virtual void SetMask(int m){ mask = m; }
+    virtual void SetMask(int m);
     virtual void SetStereoMix (int trk, xgm::INT16 mixl, xgm::INT16 mixr);
     virtual ITrackInfo *GetTrackInfo(int trk);
   };
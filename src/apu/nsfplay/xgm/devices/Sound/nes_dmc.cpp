@@ -4,6 +4,10 @@
 #include "nsfplay_math.h"
 #include <cstdlib>
 
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
 namespace xgm
 {
   const UINT32 NES_DMC::wavlen_table[2][16] = {
@@ -55,10 +59,11 @@ namespace xgm
 	option[OPT_RANDOMIZE_TRI] = 1;
     option[OPT_TRI_MUTE] = 1;
     option[OPT_DPCM_REVERSE] = 0;
-    tnd_table[0][0][0][0] = 0;
-    tnd_table[1][0][0][0] = 0;
+    tnd = &GetTNDMixer();
+    nseq = &GetNoiseSequence();
 
     apu = NULL;
+    SetRandomSeed (0);
     frame_sequence_count = 0;
     frame_sequence_length = 7458;
     frame_sequence_steps = 4;
@@ -66,6 +71,8 @@ namespace xgm
     for(int c=0;c<2;++c)
         for(int t=0;t<3;++t)
             sm[c][t] = 128;
+
+    SetMask(0); // Also selects the kernels
   }
 
 
@@ -235,9 +242,10 @@ namespace xgm
   }
 
   // 三角波チャンネルの計算 戻り値は0-15
+  template <bool TRI_MUTE>
   UINT32 NES_DMC::calc_tri (UINT32 clocks)
   {
-    static UINT32 tritbl[32] =
+    static const UINT32 tritbl[32] =
     {
      15,14,13,12,11,10, 9, 8,
       7, 6, 5, 4, 3, 2, 1, 0,
@@ -246,20 +254,123 @@ namespace xgm
     };
 
     if (linear_counter > 0 && length_counter[0] > 0
-        && (!option[OPT_TRI_MUTE] || tri_freq > 0))
+        && (!TRI_MUTE || tri_freq > 0))
     {
-      counter[0] -= clocks;
-      while (counter[0] < 0)
-      {
-        tphase = (tphase + 1) & 31;
-        counter[0] += (tri_freq + 1);
-      }
+      tphase = (tphase + count_down_divider(counter[0], tri_freq + 1, clocks)) & 31;
     }
 
     UINT32 ret = tritbl[tphase];
     return ret;
   }
 
+  static int popcount64 (UINT64 x)
+  {
+#if defined(_MSC_VER)
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#else
+    return __builtin_popcountll(x);
+#endif
+  }
+
+  // index of the lowest set bit of a non-zero x
+  static int lowest_bit64 (UINT64 x)
+  {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (int)index;
+#else
+    return __builtin_ctzll(x);
+#endif
+  }
+
+  // The noise shift register as a bit stream: bit i of the result is bit 0
+  // of the register i steps after state s, so bits i..i+14 are that state.
+  // Each new bit is x[i+15] = x[i] ^ x[i+tap], so 15-tap bits come out of
+  // one shift and xor. Returns at least n bits, n <= 64.
+  static UINT64 noise_stream (UINT32 s, int tap, int n)
+  {
+    UINT64 w = s & 0x7FFF;
+    const int run = 15 - tap;
+    for (int have = 15; have < n; have += run)
+    {
+      const UINT64 next = ((w >> (have - 15)) ^ (w >> (have - 15 + tap)))
+                        & ((1ULL << run) - 1);
+      w |= next << have;
+    }
+    return w;
+  }
+
+  static int noise_tap_shift (UINT32 noise_tap)
+  {
+    return (noise_tap & (1<<6)) ? 6 : 1;
+  }
+
+  // states an output stream of 64 bits covers
+  static const UINT32 NOISE_CHUNK = 64 - 15;
+
+  // every short mode (tap 6) state recurs after 93 steps: its cycles are
+  // 93 or 31 steps long
+  static const UINT32 NOISE_SHORT_PERIOD = 93;
+
+  // Steps the noise shift register, returning how many of the new states
+  // have bit 14 set, i.e. output silence. Short spans are generated a chunk
+  // at a time; long mode spans longer than a chunk jump through the
+  // precomputed sequence in constant time, and short mode spans are first
+  // reduced to under one period.
+  UINT32 NES_DMC::step_noise (UINT32 steps)
+  {
+    if (noise == 0) return 0; // the all-zero state never leaves itself
+
+    const int tap = noise_tap_shift(noise_tap);
+    if (tap == 1 && steps > NOISE_CHUNK)
+    {
+      const UINT32 P = NoiseSequence::PERIOD;
+      auto ones_before = [this](UINT32 i) -> UINT32 {
+        const UINT64 below = (i & 63) ? (nseq->bits[i >> 6] << (64 - (i & 63))) : 0;
+        return nseq->ones[i >> 6] + popcount64(below);
+      };
+      auto ones_from = [&](UINT32 from, UINT32 count) -> UINT32 {
+        if (from + count <= P)
+          return ones_before(from + count) - ones_before(from);
+        return ones_before(P) - ones_before(from) + ones_before(from + count - P);
+      };
+
+      // bit 14 of each new state is stream bit p+15 onwards
+      const UINT32 p = nseq->position[noise];
+      const UINT32 silent = (steps / P) * ones_before(P)
+                          + ones_from((p + 15) % P, steps % P);
+
+      const UINT32 q = (p + steps) % P;
+      UINT64 w = nseq->bits[q >> 6] >> (q & 63);
+      if ((q & 63) > 64 - 15)
+        w |= nseq->bits[(q >> 6) + 1] << (64 - (q & 63));
+      noise = (UINT32)(w & 0x7FFF);
+      return silent;
+    }
+
+    UINT32 silent = 0;
+    if (tap == 6 && steps > NOISE_SHORT_PERIOD)
+    {
+      const UINT32 cycles = steps / NOISE_SHORT_PERIOD;
+      steps %= NOISE_SHORT_PERIOD;
+      silent = cycles * step_noise(NOISE_SHORT_PERIOD); // leaves noise as it was
+    }
+
+    while (steps > 0)
+    {
+      const UINT32 n = steps < NOISE_CHUNK ? steps : NOISE_CHUNK;
+      const UINT64 w = noise_stream(noise, tap, (int)(15 + n));
+      silent += popcount64((w >> 15) & ((1ULL << n) - 1));
+      noise = (UINT32)((w >> n) & 0x7FFF);
+      steps -= n;
+    }
+    return silent;
+  }
+
   // ノイズチャンネルの計算 戻り値は0-127
   // 低サンプリングレートで合成するとエイリアスノイズが激しいので
   // ノイズだけはこの関数内で高クロック合成し、簡易なサンプリングレート
@@ -273,7 +384,6 @@ namespace xgm
     if (clocks < 1) return last;
 
     // simple anti-aliasing (noise requires it, even when oversampling is off)
-    UINT32 count = 0;
     UINT32 accum = counter[1] * last; // samples pending from previous calc
     UINT32 accum_clocks = counter[1];
     #ifdef _DEBUG
@@ -286,25 +396,21 @@ namespace xgm
     }
 
     counter[1] -= clocks;
-    assert (nfreq > 0); // prevent infinite loop
-    while (counter[1] < 0)
-    {
-        // tick the noise generator
-        UINT32 feedback = (noise&1) ^ ((noise&noise_tap)?1:0);
-        noise = (noise>>1) | (feedback<<14);
-
-        last = (noise & 0x4000) ? 0 : env;
-        accum += (last * nfreq);
-        counter[1] += nfreq;
-        ++count;
-        accum_clocks += nfreq;
-    }
-
-    if (count < 1) // no change over interval, don't anti-alias
+    if (counter[1] >= 0) // no change over interval, don't anti-alias
     {
        return last;
     }
 
+    // The generator ticks once per nfreq clocks; every tick adds nfreq
+    // clocks of its new output, env or 0, to the average
+    assert (nfreq > 0);
+    const UINT32 count = ((UINT32)-counter[1] + nfreq - 1) / nfreq;
+    const UINT32 silent = step_noise(count);
+    counter[1] += (INT32)(count * nfreq);
+    accum += env * nfreq * (count - silent);
+    accum_clocks += count * nfreq;
+    last = (noise & 0x4000) ? 0 : env;
+
     accum -= (last * counter[1]); // remove these samples which belong in the next calc
     accum_clocks -= counter[1];
     #ifdef _DEBUG
@@ -388,9 +494,22 @@ namespace xgm
       }
   }
 
+  // Clocks that TickFrameSequence() can run without stepping the sequencer.
+  // The step happens on the tick that goes past this count.
+  UINT32 NES_DMC::ClocksUntilFrameSequence () const
+  {
+      return frame_sequence_length - frame_sequence_count;
+  }
+
   void NES_DMC::Tick (UINT32 clocks)
   {
-    out[0] = calc_tri(clocks);
+    (this->*tick_kernel)(clocks);
+  }
+
+  template <bool TRI_MUTE>
+  void NES_DMC::tick (UINT32 clocks)
+  {
+    out[0] = calc_tri<TRI_MUTE>(clocks);
     out[1] = calc_noise(clocks);
     out[2] = calc_dmc(clocks);
   }
@@ -413,13 +532,12 @@ namespace xgm
       }
 
       // See calc_noise().
-      // Unfortunately, at noise pitch $F, this updates every 4 clocks,
-      // which drains CPU especially in debug builds.
-      //
-      // One solution is to only update noise intermittently,
-      // However it's tricky to get right, and may require editing calc_noise().
-      //
-      // For now, just accept the increased CPU usage as a tradeoff.
+      // At noise pitch $F the generator ticks every 4 clocks, but about half
+      // of its ticks leave the output as it was. Reading ahead in the bit
+      // stream finds the tick before the output next changes, so the
+      // renderer stops there instead of at every tick. calc_noise() ticks
+      // that span unchanged output average to that same output, so the
+      // result is identical.
       {
           UINT32 env = envelope_disable ? noise_volume : envelope_counter;
           if (length_counter[1] < 1) env = 0;
@@ -429,7 +547,16 @@ namespace xgm
                       // "only happens on startup when using the randomize noise option", idk what to return
                       return (UINT32)1;
                   }
-                  return value_or((UINT32) counter[1], nfreq);
+                  // bit i = output silent i ticks from now
+                  const UINT64 silent = noise_stream(noise, noise_tap_shift(noise_tap), 32) >> 14;
+                  // bit i = output changes on tick i+1; 17 ticks looked at
+                  const UINT64 change = (silent ^ (silent >> 1)) & 0x1FFFF;
+                  UINT32 ticks = change ? (UINT32)lowest_bit64(change) : 17;
+
+                  // A countdown of 0 has already had its stop, so the
+                  // earliest stop left is the next tick
+                  if (counter[1] == 0 && ticks == 0) ticks = 1;
+                  return (UINT32)counter[1] + ticks * nfreq;
               }());
           }
       }
@@ -447,19 +574,54 @@ namespace xgm
 
   UINT32 NES_DMC::Render (INT32 b[2])
   {
-    out[0] = (mask & 1) ? 0 : out[0];
-    out[1] = (mask & 2) ? 0 : out[1];
-    out[2] = (mask & 4) ? 0 : out[2];
+    (this->*mix_kernel)(b);
+    return 2;
+  }
+
+  template <bool NONLINEAR, bool ANTI_CLICK, bool MASKED>
+  void NES_DMC::render_sample (INT32 b[2])
+  {
+    if constexpr (MASKED)
+    {
+        out[0] &= mask_keep[0];
+        out[1] &= mask_keep[1];
+        out[2] &= mask_keep[2];
+    }
+    mix_tnd<NONLINEAR, ANTI_CLICK>(b);
+  }
+
+  template <bool TRI_MUTE>
+  void NES_DMC::TickWith (UINT32 clocks)
+  {
+    tick<TRI_MUTE>(clocks);
+  }
+
+  template <bool NONLINEAR, bool ANTI_CLICK>
+  UINT32 NES_DMC::RenderWith (INT32 b[2])
+  {
+    render_sample<NONLINEAR, ANTI_CLICK, false>(b);
+    return 2;
+  }
+
+  template void NES_DMC::TickWith<true> (UINT32 clocks);
+  template void NES_DMC::TickWith<false> (UINT32 clocks);
+  template UINT32 NES_DMC::RenderWith<true, true> (INT32 b[2]);
+  template UINT32 NES_DMC::RenderWith<true, false> (INT32 b[2]);
+  template UINT32 NES_DMC::RenderWith<false, true> (INT32 b[2]);
+  template UINT32 NES_DMC::RenderWith<false, false> (INT32 b[2]);
 
+  template <bool NONLINEAR, bool ANTI_CLICK>
+  void NES_DMC::mix_tnd (INT32 b[2])
+  {
     INT32 m[3];
-    m[0] = tnd_table[0][out[0]][0][0];
-    m[1] = tnd_table[0][0][out[1]][0];
-    m[2] = tnd_table[0][0][0][out[2]];
+    m[0] = tnd->tri[out[0]];
+    m[1] = tnd->noise[out[1]];
+    m[2] = tnd->dmc[out[2]];
 
-    if (option[OPT_NONLINEAR_MIXER])
+    if constexpr (NONLINEAR)
     {
         INT32 ref = m[0] + m[1] + m[2];
-        INT32 voltage = tnd_table[1][out[0]][out[1]][out[2]];
+        INT32 voltage = tnd->voltage(out[0], out[1], out[2]);
         if (ref)
         {
             for (int i=0; i < 3; ++i)
@@ -473,7 +635,7 @@ namespace xgm
     }
 
     // anti-click nullifies any 4011 write but preserves nonlinearity
-    if (option[OPT_DPCM_ANTI_CLICK])
+    if constexpr (ANTI_CLICK)
     {
         if (dmc_pop) // $4011 will cause pop this frame
         {
@@ -505,8 +667,92 @@ namespace xgm
     b[1] += m[1] * sm[1][1];
     b[1] += m[2] * sm[1][2];
     b[1] >>= 7;
+  }
 
-    return 2;
+  void NES_DMC::RenderBlock (INT32* b, UINT32 frames, const UINT32* clocks)
+  {
+    (this->*block_kernel)(b, frames, clocks);
+  }
+
+  UINT32 NES_DMC::RenderChannels (INT32* b, bool nonlinear) const
+  {
+    // The anti-click offset belongs to the mix, so the DMC stem is the raw DAC
+    const UINT32 t = out[0] & mask_keep[0];
+    const UINT32 n = out[1] & mask_keep[1];
+    const UINT32 d = out[2] & mask_keep[2];
+    if (nonlinear)
+    {
+        b[0] = tnd->voltage(t, 0, 0);
+        b[1] = tnd->voltage(0, n, 0);
+        b[2] = tnd->voltage(0, 0, d);
+    }
+    else
+    {
+        b[0] = tnd->tri[t];
+        b[1] = tnd->noise[n];
+        b[2] = tnd->dmc[d];
+    }
+    return 3;
+  }
+
+  template <bool NONLINEAR, bool ANTI_CLICK, bool TRI_MUTE, bool MASKED>
+  void NES_DMC::render_block (INT32* b, UINT32 frames, const UINT32* clocks)
+  {
+    // Noise anti-aliasing and DPCM fetches keep too much interdependent state
+    // to hoist, so this runs the per-frame path with the options resolved.
+    for (UINT32 f = 0; f < frames; ++f)
+    {
+        if (clocks[f]) tick<TRI_MUTE>(clocks[f]);
+
+        INT32 m[2];
+        render_sample<NONLINEAR, ANTI_CLICK, MASKED>(m);
+        b[2*f]   += m[0];
+        b[2*f+1] += m[1];
+    }
+  }
+
+  void NES_DMC::select_kernels ()
+  {
+    if (option[OPT_TRI_MUTE])
+      tick_kernel = &NES_DMC::tick<true>;
+    else
+      tick_kernel = &NES_DMC::tick<false>;
+
+    if (option[OPT_NONLINEAR_MIXER])
+    {
+      if (option[OPT_DPCM_ANTI_CLICK]) select_block_kernel<true, true>();
+      else                             select_block_kernel<true, false>();
+    }
+    else
+    {
+      if (option[OPT_DPCM_ANTI_CLICK]) select_block_kernel<false, true>();
+      else                             select_block_kernel<false, false>();
+    }
+  }
+
+  template <bool NONLINEAR, bool ANTI_CLICK>
+  void NES_DMC::select_block_kernel ()
+  {
+    if (mask) select_masked_kernel<NONLINEAR, ANTI_CLICK, true>();
+    else      select_masked_kernel<NONLINEAR, ANTI_CLICK, false>();
+  }
+
+  template <bool NONLINEAR, bool ANTI_CLICK, bool MASKED>
+  void NES_DMC::select_masked_kernel ()
+  {
+    mix_kernel = &NES_DMC::render_sample<NONLINEAR, ANTI_CLICK, MASKED>;
+    if (option[OPT_TRI_MUTE])
+      block_kernel = &NES_DMC::render_block<NONLINEAR, ANTI_CLICK, true, MASKED>;
+    else
+      block_kernel = &NES_DMC::render_block<NONLINEAR, ANTI_CLICK, false, MASKED>;
+  }
+
+  void NES_DMC::SetMask (int m)
+  {
+    mask = m;
+    for (int i=0; i < 3; ++i)
+        mask_keep[i] = (mask & (1 << i)) ? 0u : ~0u;
+    select_kernels();
   }
 
   void NES_DMC::SetClock (double c)
@@ -531,8 +777,9 @@ namespace xgm
       apu = apu_;
   }
 
-  // Initializing TRI, NOISE, DPCM mixing table
-  void NES_DMC::InitializeTNDTable(double wt, double wn, double wd) {
+  // Initializing TRI, NOISE, DPCM mixing table (built once, on first use)
+  static NES_DMC::TNDMixer MakeTNDMixer(double wd) {
+    NES_DMC::TNDMixer mixer {};
 
     // volume adjusted by 0.95 based on empirical measurements
     // MDFourier tests show that this seems to further deviate from hardware
@@ -545,34 +792,66 @@ namespace xgm
     // because of the lack of a good DAC model, currently.
 
     { // Linear Mixer
-      for(int t=0; t<16 ; t++) {
-        for(int n=0; n<16; n++) {
-          for(int d=0; d<128; d++) {
-              tnd_table[0][t][n][d] = (UINT32)(MASTER*(3.0*t+2.0*n+d)/208.0);
-          }
-        }
-      }
+      for(int t=0; t<16 ; t++) mixer.tri[t]   = (UINT32)(MASTER*(3.0*t)/208.0);
+      for(int n=0; n<16 ; n++) mixer.noise[n] = (UINT32)(MASTER*(2.0*n)/208.0);
+      for(int d=0; d<128; d++) mixer.dmc[d]   = (UINT32)(MASTER*(1.0*d)/208.0);
     }
     { // Non-Linear Mixer
-      tnd_table[1][0][0][0] = 0;
-      for(int t=0; t<16 ; t++) {
-        for(int n=0; n<16; n++) {
-          for(int d=0; d<128; d++) {
-            if(t!=0||n!=0||d!=0)
-              tnd_table[1][t][n][d] = (UINT32)((MASTER*159.79)/(100.0+1.0/((double)t/wt+(double)n/wn+(double)d/wd)));
-          }
-        }
-      }
+      // the old formula over t/wt+n/wn+d/wd, with the DMC weight wd exact
+      // and the others rounded into DAC_TRI and DAC_NOISE; the peak (all
+      // channels at full level) is about 6075, so UINT16 holds every entry
+      const double scale = wd * NES_DMC::TNDMixer::DAC_DMC;
+      for(int i=1; i<NES_DMC::TNDMixer::DAC_SIZE; i++)
+        mixer.dac[i] = (UINT16)((MASTER*159.79)/(100.0+scale/(double)i));
     }
 
+    return mixer;
+  }
+
+  const NES_DMC::TNDMixer& NES_DMC::GetTNDMixer()
+  {
+    static const TNDMixer mixer = MakeTNDMixer(22638);
+    return mixer;
+  }
+
+  static NES_DMC::NoiseSequence MakeNoiseSequence()
+  {
+    NES_DMC::NoiseSequence seq {};
+    const UINT32 P = NES_DMC::NoiseSequence::PERIOD;
+
+    // one period from state 1, plus the 15 bits that spell the last states
+    UINT32 s = 1;
+    for (UINT32 i = 0; i < P + 15; ++i)
+    {
+      if (i < P) seq.position[s] = (UINT16)i;
+      seq.bits[i >> 6] |= (UINT64)(s & 1) << (i & 63);
+      const UINT32 feedback = (s & 1) ^ ((s >> 1) & 1);
+      s = (s >> 1) | (feedback << 14);
+    }
+
+    UINT32 ones = 0;
+    for (UINT32 w = 0; w < P / 64 + 2; ++w)
+    {
+      seq.ones[w] = (UINT16)ones;
+      // only count bits of the first period
+      UINT64 bits = seq.bits[w];
+      if (w * 64 + 64 > P)
+        bits = (w * 64 >= P) ? 0 : bits & ((1ULL << (P - w * 64)) - 1);
+      ones += popcount64(bits);
+    }
+    return seq;
+  }
+
+  const NES_DMC::NoiseSequence& NES_DMC::GetNoiseSequence()
+  {
+    static const NoiseSequence sequence = MakeNoiseSequence();
+    return sequence;
   }
 
   void NES_DMC::Reset ()
   {
     int i;
-    mask = 0;
-
-    InitializeTNDTable(8227,12241,22638);
+    SetMask(0);
 
     counter[0] = 0;
     counter[1] = 0;
@@ -632,13 +911,13 @@ namespace xgm
 
     if (option[OPT_RANDOMIZE_NOISE])
     {
-        noise |= ::rand();
-        counter[1] = -(rand() & 511);
+        noise |= rand_next() & 0x7FFF;
+        counter[1] = -(INT32)(rand_next() & 511);
     }
     if (option[OPT_RANDOMIZE_TRI])
     {
-        tphase = ::rand() & 31;
-        counter[0] = -(rand() & 2047);
+        tphase = rand_next() & 31;
+        counter[0] = -(INT32)(rand_next() & 2047);
     }
 
     SetRate(rate);
@@ -649,13 +928,27 @@ namespace xgm
     memory = r;
   }
 
+  void NES_DMC::SetRandomSeed (UINT32 seed)
+  {
+    rand_state = seed ? seed : 0x2545F491; // xorshift state must be nonzero
+  }
+
+  // xorshift32
+  UINT32 NES_DMC::rand_next ()
+  {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+  }
+
   void NES_DMC::SetOption (int id, int val)
   {
     if(id<OPT_END)
     {
       option[id] = val;
-      if(id==OPT_NONLINEAR_MIXER)
-        InitializeTNDTable(8227,12241,22638);
+      if(id==OPT_NONLINEAR_MIXER || id==OPT_DPCM_ANTI_CLICK || id==OPT_TRI_MUTE)
+        select_kernels();
     }
   }
 
@@ -680,8 +973,14 @@ namespace xgm
         0x20, 0x1E
     };
 
-    if (adr == 0x4015)
+    // One switch over every register this core owns; NessyAPU only sends
+    // it $4008-$4013, $4015 and $4017
+    switch (adr)
     {
+
+    // status
+
+    case 0x4015:
       enable[0] = (val & 4) ? true : false;
       enable[1] = (val & 8) ? true : false;
 
@@ -706,13 +1005,11 @@ namespace xgm
 
       irq = false;
       cpu->UpdateIRQ(NES_CPU::IRQD_DMC, false);
+      break;
 
-      reg[adr-0x4008] = val;
-      return true;
-    }
+    // frame counter
 
-    if (adr == 0x4017)
-    {
+    case 0x4017:
       //DEBUG_OUT("4017 = %02X\n", val);
       frame_irq_enable = ((val & 0x40) != 0x40);
       if (frame_irq_enable) frame_irq = false;
@@ -731,17 +1028,7 @@ namespace xgm
         frame_sequence_steps = 4;
         frame_sequence_step = 1;
       }
-    }
-
-    if (adr<0x4008||0x4013<adr)
-      return false;
-
-    reg[adr-0x4008] = val&0xff;
-
-    //DEBUG_OUT("$%04X %02X\n", adr, val);
-
-    switch (adr)
-    {
+      return true; // $4017 is not kept in reg[]
 
     // tri
 
@@ -829,6 +1116,7 @@ namespace xgm
       return false;
     }
 
+    reg[adr-0x4008] = val&0xff;
     return true;
   }
 
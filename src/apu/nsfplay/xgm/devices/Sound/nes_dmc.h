@@ -8,43 +8,12 @@ namespace xgm
 {
   class NES_APU; // forward declaration
 
-  /** Bottom Half of APU **/
-  class NES_DMC:public ISoundChip
+  /** Emulation state of NES_DMC. Plain data, so a snapshot is a memcpy. **/
+  struct NES_DMC_State
   {
-  public:
-    enum
-    { 
-      OPT_ENABLE_4011=0,
-      OPT_ENABLE_PNOISE,
-      OPT_UNMUTE_ON_RESET,
-      OPT_DPCM_ANTI_CLICK,
-      OPT_NONLINEAR_MIXER,
-      OPT_RANDOMIZE_NOISE,
-      OPT_TRI_MUTE,
-      OPT_RANDOMIZE_TRI,
-      OPT_DPCM_REVERSE,
-      OPT_END 
-    };
-  protected:
-    const int GETA_BITS;
-
-  public:
-    // DPCM.
-    static const UINT32 freq_table[2][16];
-
-  public:
-    // Noise.
-    static const UINT32 wavlen_table[2][16];
-
-    UINT32 tnd_table[2][16][16][128];
-
-    int option[OPT_END];
-    int mask;
-    INT32 sm[2][3];
     UINT8 reg[0x10];
     UINT32 len_reg;
     UINT32 adr_reg;
-    IDevice *memory;
     UINT32 out[3];
     UINT32 daddress;
     UINT32 dlength;
@@ -55,9 +24,6 @@ namespace xgm
     bool dmc_pop;
     INT32 dmc_pop_offset;
     INT32 dmc_pop_follow;
-    double clock;
-    UINT32 rate;
-    int pal;
     int mode;
     bool irq;
 
@@ -86,22 +52,126 @@ namespace xgm
     bool enable[2]; // tri/noise enable
     int length_counter[2]; // 0=tri, 1=noise
 
-    TrackInfoBasic trkinfo[3];
-
     // frame sequencer
-    NES_APU* apu; // apu is clocked by DMC's frame sequencer
     int frame_sequence_count;  // current cycle count
-    int frame_sequence_length; // CPU cycles per FrameSequence
     int frame_sequence_step;   // current step of frame sequence
     int frame_sequence_steps;  // 4/5 steps per frame
     bool frame_irq;
     bool frame_irq_enable;
 
+    // Per-instance generator for the randomize options, in place of the
+    // shared ::rand() state, so instances on different threads never race
+    UINT32 rand_state;
+  };
+
+  /** Bottom Half of APU **/
+  class NES_DMC:public ISoundChip, public NES_DMC_State
+  {
+  public:
+    enum
+    { 
+      OPT_ENABLE_4011=0,
+      OPT_ENABLE_PNOISE,
+      OPT_UNMUTE_ON_RESET,
+      OPT_DPCM_ANTI_CLICK,
+      OPT_NONLINEAR_MIXER,
+      OPT_RANDOMIZE_NOISE,
+      OPT_TRI_MUTE,
+      OPT_RANDOMIZE_TRI,
+      OPT_DPCM_REVERSE,
+      OPT_END 
+    };
+  protected:
+    const int GETA_BITS;
+
+  public:
+    // DPCM.
+    static const UINT32 freq_table[2][16];
+
+  public:
+    // Noise.
+    static const UINT32 wavlen_table[2][16];
+
+    // The long-mode LFSR sequence as its output bit stream: bit i is bit 0
+    // of the shift register i steps after state 1, so bits i..i+14 are that
+    // state. Finding a state's place, the state k steps on and how many of
+    // the states in between are silent are all lookups (see step_noise()).
+    struct NoiseSequence
+    {
+      static const UINT32 PERIOD = 32767;
+      UINT64 bits[PERIOD / 64 + 2];
+      UINT16 ones[PERIOD / 64 + 2];    // set bits before each word
+      UINT16 position[0x8000];         // steps from state 1 to each state
+    };
+    const NoiseSequence* nseq;
+
+    // Triangle/noise/DMC mixer. The old tnd_table[2][16][16][128] took 256KB
+    // per instance; this one is built once and shared read-only by every
+    // NES_DMC (see GetTNDMixer()). The linear mixer factors into per-channel
+    // levels. The nonlinear DAC only depends on the weighted sum of t, n and
+    // d, so it is an 8KB table indexed by that sum in integer weights, close
+    // enough to 8227:12241:22638 to stay within 1 of the old table.
+    struct TNDMixer
+    {
+      // 20 * 22638 / 8227 and 20 * 22638 / 12241, rounded
+      enum { DAC_TRI = 55, DAC_NOISE = 37, DAC_DMC = 20 };
+      enum { DAC_SIZE = 15*DAC_TRI + 15*DAC_NOISE + 127*DAC_DMC + 1 };
+
+      UINT32 tri[16], noise[16], dmc[128];          // linear mixer levels
+      UINT16 dac[DAC_SIZE];                         // nonlinear mixer output
+
+      // nonlinear mixer output, approximating the old tnd_table[1][t][n][d]
+      UINT32 voltage (UINT32 t, UINT32 n, UINT32 d) const
+      {
+        return dac[t*DAC_TRI + n*DAC_NOISE + d*DAC_DMC];
+      }
+    };
+    const TNDMixer* tnd;
+
+    int option[OPT_END];
+    int mask;
+    UINT32 mask_keep[3]; // ~0 for a channel SetMask() leaves audible, else 0
+    INT32 sm[2][3];
+    IDevice *memory;
+    double clock;
+    UINT32 rate;
+    int pal;
+    TrackInfoBasic trkinfo[3];
+
+    // frame sequencer
+    NES_APU* apu; // apu is clocked by DMC's frame sequencer
+    int frame_sequence_length; // CPU cycles per FrameSequence
+
     NES_CPU* cpu; // IRQ needs CPU access
 
+    UINT32 rand_next ();
+
+    template <bool TRI_MUTE>
     inline UINT32 calc_tri (UINT32 clocks);
     inline UINT32 calc_dmc (UINT32 clocks);
     inline UINT32 calc_noise (UINT32 clocks);
+    UINT32 step_noise (UINT32 steps);
+
+    template <bool TRI_MUTE>
+    void tick (UINT32 clocks);
+    template <bool NONLINEAR, bool ANTI_CLICK>
+    void mix_tnd (INT32 b[2]);
+    template <bool NONLINEAR, bool ANTI_CLICK, bool MASKED>
+    void render_sample (INT32 b[2]);
+    template <bool NONLINEAR, bool ANTI_CLICK, bool TRI_MUTE, bool MASKED>
+    void render_block (INT32* b, UINT32 frames, const UINT32* clocks);
+
+    // Tick and render kernels specialized for the current options and mask,
+    // so the render paths never test option[] or mask. Chosen by
+    // select_kernels() in SetOption() and SetMask().
+    void (NES_DMC::*tick_kernel) (UINT32 clocks);
+    void (NES_DMC::*mix_kernel) (INT32 b[2]);
+    void (NES_DMC::*block_kernel) (INT32* b, UINT32 frames, const UINT32* clocks);
+    void select_kernels ();
+    template <bool NONLINEAR, bool ANTI_CLICK>
+    void select_block_kernel ();
+    template <bool NONLINEAR, bool ANTI_CLICK, bool MASKED>
+    void select_masked_kernel ();
 
   public:
       NES_DMC ();
@@ -114,24 +184,45 @@ namespace xgm
     UINT8 GetSamplePos() const;
     UINT8 GetDeltaCounter() const;
     bool IsPlaying() const;
-    void InitializeTNDTable(double wt, double wn, double wd);
+    static const TNDMixer& GetTNDMixer();
+    static const NoiseSequence& GetNoiseSequence();
     void SetPal (bool is_pal);
     void SetAPU (NES_APU* apu_);
     void SetMemory (IDevice * r);
+    void SetRandomSeed (UINT32 seed);
     void FrameSequence(int s);
+
+    // options, rate, PAL mode and the memory/APU/CPU links are configuration,
+    // not saved state
+    typedef NES_DMC_State State;
+    void SaveState (State& s) const { s = *this; }
+    void LoadState (const State& s) { static_cast<State&>(*this) = s; }
     int GetDamp(){ return (damp<<1)|dac_lsb ; }
     void TickFrameSequence (UINT32 clocks);
+    UINT32 ClocksUntilFrameSequence () const;
 
     virtual void Reset ();
     virtual void Tick (UINT32 clocks);
     UINT32 ClocksUntilLevelChange() override;
     virtual UINT32 Render (INT32 b[2]);
+    // Tick() and Render() through the unmasked kernels for options known at
+    // compile time, for callers that fix the options (see ChipSet). The core
+    // must be configured to match.
+    template <bool TRI_MUTE>
+    void TickWith (UINT32 clocks);
+    template <bool NONLINEAR, bool ANTI_CLICK>
+    UINT32 RenderWith (INT32 b[2]);
+    void RenderBlock (INT32* b, UINT32 frames, const UINT32* clocks) override;
+    // Each channel's level alone and unpanned, as Render() would mix it with
+    // the other channels silent, into b[0..2]; returns the channel count.
+    // With nonlinear false the channels go through the linear mixer instead.
+    UINT32 RenderChannels (INT32* b, bool nonlinear) const;
     virtual bool Write (UINT32 adr, UINT32 val, UINT32 id=0);
     virtual bool Read (UINT32 adr, UINT32 & val, UINT32 id=0);
     virtual void SetRate (double rate);
     virtual void SetClock (double rate);
     virtual void SetOption (int, int);
-    virtual void SetMask(int m){ mask = m; }
+    virtual void SetMask(int m);
     virtual void SetStereoMix (int trk, xgm::INT16 mixl, xgm::INT16 mixr);
     virtual ITrackInfo *GetTrackInfo(int trk);
 
@@ -1,7 +1,10 @@
 #include "nes_vrc6.h"
+#include <algorithm>
 
 namespace xgm
 {
+  // master volume adjustment, relative to the 2A03
+  static const INT32 MASTER = INT32(256.0 * 1223.0 / 1920.0);
 
   NES_VRC6::NES_VRC6 ()
   {
@@ -14,6 +17,8 @@ namespace xgm
     for(int c=0;c<2;++c)
         for(int t=0;t<3;++t)
             sm[c][t] = 128;
+
+    SetMask (0);
   }
 
   NES_VRC6::~NES_VRC6 ()
@@ -26,6 +31,24 @@ namespace xgm
       if (trk > 2) return;
       sm[0][trk] = mixl;
       sm[1][trk] = mixr;
+      update_mix();
+  }
+
+  void NES_VRC6::SetMask (int m)
+  {
+    mask = m;
+    for (int i = 0; i < 3; ++i)
+      mask_keep[i] = (mask & (1 << i)) ? 0 : ~0;
+    update_mix();
+  }
+
+  // The mix is linear, so muting a channel is the same as zeroing its
+  // column of the stereo mix; Render() then never looks at the mask
+  void NES_VRC6::update_mix ()
+  {
+    for (int c = 0; c < 2; ++c)
+      for (int t = 0; t < 3; ++t)
+        mix[c][t] = sm[c][t] & mask_keep[t];
   }
 
   ITrackInfo *NES_VRC6::GetTrackInfo(int trk)
@@ -82,7 +105,7 @@ namespace xgm
       Write (0xb000 + i, 0);
     }
     count14 = 0;
-    mask = 0;
+    SetMask (0);
     counter[0] = 0;
     counter[1] = 0;
     counter[2] = 0;
@@ -91,31 +114,55 @@ namespace xgm
     phase[0] = 2;
   }
 
-  INT16 NES_VRC6::calc_sqr (int i, UINT32 clocks)
+  static const INT16 sqrtbl[8][16] = {
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1},
+    {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1}
+  };
+
+  // Advances a divider that counts up by `clocks` and wraps to 0 once it
+  // passes `reload`. Returns the number of wraps, in constant time.
+  static inline UINT32 count_up_divider (UINT32& counter, UINT32 reload, UINT32 clocks)
   {
-    static const INT16 sqrtbl[8][16] = {
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1},
-      {0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1},
-      {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1, 1, 1, 1}
-    };
+    counter += clocks;
+    if (counter <= reload)
+      return 0;
+    const UINT32 steps = counter / (reload + 1);
+    counter %= (reload + 1);
+    return steps;
+  }
+
+  // Runs the saw accumulator for `steps` divider steps: it adds `rate` on
+  // every even step of count14 and clears on the 14th. Only the steps after
+  // the last clear matter, so this is constant time too.
+  static inline void step_saw (UINT32& acc, int& count14, int rate, UINT32 steps)
+  {
+    const UINT32 total = (UINT32)count14 + steps;
+    if (total >= 14)
+    {
+      count14 = (int)(total % 14);
+      acc = ((UINT32)rate * (UINT32)(count14 >> 1)) & 0xFF;
+    }
+    else
+    {
+      const UINT32 adds = (total >> 1) - ((UINT32)count14 >> 1);
+      count14 = (int)total;
+      acc = (acc + (UINT32)rate * adds) & 0xFF; // note 8-bit wrapping behaviour
+    }
+  }
 
+  INT16 NES_VRC6::calc_sqr (int i, UINT32 clocks)
+  {
     if (!enable[i])
       return 0;
 
     if (!halt)
-    {
-      counter[i] += clocks;
-      while(counter[i] > freq2[i])
-      {
-          phase[i] = (phase[i] + 1) & 15;
-          counter[i] -= (freq2[i] + 1);
-      }
-    }
+      phase[i] = (phase[i] + count_up_divider(counter[i], freq2[i], clocks)) & 15;
 
     return (gate[i]
       || sqrtbl[duty[i]][phase[i]])? volume[i] : 0;
@@ -127,25 +174,7 @@ namespace xgm
       return 0;
 
     if (!halt)
-    {
-      counter[2] += clocks;
-      while(counter[2] > freq2[2])
-      {
-          counter[2] -= (freq2[2] + 1);
-
-          // accumulate saw
-          ++count14;
-          if (count14 >= 14)
-          {
-            count14 = 0;
-            phase[2] = 0;
-          }
-          else if (0 == (count14 & 1)) // only accumulate on even ticks
-          {
-            phase[2] = (phase[2] + volume[2]) & 0xFF; // note 8-bit wrapping behaviour
-          }
-      }
-    }
+      step_saw(phase[2], count14, volume[2], count_up_divider(counter[2], freq2[2], clocks));
 
     // only top 5 bits of saw are output
     return phase[2] >> 3;
@@ -158,37 +187,113 @@ namespace xgm
     out[2] = calc_saw(clocks);
   }
 
-  UINT32 NES_VRC6::Render (INT32 b[2])
+  UINT32 NES_VRC6::ClocksUntilLevelChange ()
+  {
+    // a near-infinite number of cycles (longer than 1 second).
+    UINT32 out = 1 << 24;
+    if (halt) return out;
+
+    // See calc_sqr().
+    // The phase steps once the counter passes freq2, so the level can change
+    // freq2 - counter + 1 clocks from now. Gated or silent squares hold a
+    // constant level whatever their phase.
+    for (int i = 0; i < 2; ++i)
+    {
+      if (enable[i] && !gate[i] && volume[i] > 0)
+        out = std::min(out, freq2[i] - counter[i] + 1);
+    }
+
+    // See calc_saw().
+    // Even with a zero accumulator rate, the 14-step reset can change the level.
+    if (enable[2])
+      out = std::min(out, freq2[2] - counter[2] + 1);
+
+    return out;
+  }
+
+  void NES_VRC6::mix_vrc6 (const INT32 o[3], INT32 b[2]) const
   {
     INT32 m[3];
-    m[0] = out[0];
-    m[1] = out[1];
-    m[2] = out[2];
 
     // note: signal is inverted compared to 2A03
 
-    m[0] = (mask & 1) ? 0 : -m[0];
-    m[1] = (mask & 2) ? 0 : -m[1];
-    m[2] = (mask & 4) ? 0 : -m[2];
+    m[0] = -o[0];
+    m[1] = -o[1];
+    m[2] = -o[2];
 
-    b[0]  = m[0] * sm[0][0];
-    b[0] += m[1] * sm[0][1];
-    b[0] += m[2] * sm[0][2];
+    b[0]  = m[0] * mix[0][0];
+    b[0] += m[1] * mix[0][1];
+    b[0] += m[2] * mix[0][2];
     //b[0] >>= (7 - 7);
 
-    b[1]  = m[0] * sm[1][0];
-    b[1] += m[1] * sm[1][1];
-    b[1] += m[2] * sm[1][2];
+    b[1]  = m[0] * mix[1][0];
+    b[1] += m[1] * mix[1][1];
+    b[1] += m[2] * mix[1][2];
     //b[1] >>= (7 - 7);
 
     // master volume adjustment
-    const INT32 MASTER = INT32(256.0 * 1223.0 / 1920.0);
     b[0] = (b[0] * MASTER) >> 8;
     b[1] = (b[1] * MASTER) >> 8;
+  }
 
+  UINT32 NES_VRC6::Render (INT32 b[2])
+  {
+    mix_vrc6(out, b);
     return 2;
   }
 
+  UINT32 NES_VRC6::RenderChannels (INT32* b, bool) const
+  {
+    // The VRC6 mixes linearly either way; unity stereo mix is 128
+    for (int i = 0; i < 3; ++i)
+    {
+        const INT32 m = -(out[i] & mask_keep[i]);
+        b[i] = (m * 128 * MASTER) >> 8;
+    }
+    return 3;
+  }
+
+  void NES_VRC6::RenderBlock (INT32* b, UINT32 frames, const UINT32* clocks)
+  {
+    // Registers cannot change inside a block, so only the dividers, phases
+    // and saw accumulator advance. Everything else is hoisted into locals.
+    UINT32 cnt[3] = { counter[0], counter[1], counter[2] };
+    UINT32 ph[3] = { phase[0], phase[1], phase[2] };
+    int c14 = count14;
+    INT32 o[3] = { out[0], out[1], out[2] };
+    const bool run[3] = { enable[0] && !halt, enable[1] && !halt, enable[2] && !halt };
+    const INT16* wave[2] = { sqrtbl[duty[0]], sqrtbl[duty[1]] };
+
+    for (UINT32 f = 0; f < frames; ++f)
+    {
+        if (clocks[f])
+        {
+            for (int i = 0; i < 2; ++i)
+            {
+                if (run[i])
+                    ph[i] = (ph[i] + count_up_divider(cnt[i], freq2[i], clocks[f])) & 15;
+                o[i] = (enable[i] && (gate[i] || wave[i][ph[i]])) ? volume[i] : 0;
+            }
+            if (run[2])
+                step_saw(ph[2], c14, volume[2], count_up_divider(cnt[2], freq2[2], clocks[f]));
+            o[2] = enable[2] ? (ph[2] >> 3) : 0;
+        }
+
+        INT32 m[2];
+        mix_vrc6(o, m);
+        b[2*f]   += m[0];
+        b[2*f+1] += m[1];
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        counter[i] = cnt[i];
+        phase[i] = ph[i];
+        out[i] = o[i];
+    }
+    count14 = c14;
+  }
+
   bool NES_VRC6::Write (UINT32 adr, UINT32 val, UINT32 id)
   {
     int ch, cmap[4] = { 0, 0, 1, 2 };
@@ -5,48 +5,68 @@
 namespace xgm
 {
 
-  class NES_VRC6:public ISoundChip
+  /** Emulation state of NES_VRC6. Plain data, so a snapshot is a memcpy. **/
+  struct NES_VRC6_State
   {
-  public:
-    enum
-    {
-      OPT_END
-    };
-  protected:
     UINT32 counter[3]; // frequency divider
     UINT32 phase[3];   // phase counter
     UINT32 freq2[3];   // adjusted frequency
     int count14;       // saw 14-stage counter
 
-    //int option[OPT_END];
-    int mask;
-    INT32 sm[2][3]; // stereo mix
     int duty[2];
     int volume[3];
     int enable[3];
     int gate[3];
     UINT32 freq[3];
-    INT16 calc_sqr (int i, UINT32 clocks);
-    INT16 calc_saw (UINT32 clocks);
     bool halt;
     int freq_shift;
-    double clock, rate;
     INT32 out[3];
+  };
+
+  class NES_VRC6:public ISoundChip, protected NES_VRC6_State
+  {
+  public:
+    enum
+    {
+      OPT_END
+    };
+  protected:
+    //int option[OPT_END];
+    int mask;
+    INT32 mask_keep[3]; // ~0 for a channel SetMask() leaves audible, else 0
+    INT32 sm[2][3]; // stereo mix
+    INT32 mix[2][3]; // sm with the masked channels' columns zeroed
+    void update_mix ();
+    INT16 calc_sqr (int i, UINT32 clocks);
+    INT16 calc_saw (UINT32 clocks);
+    inline void mix_vrc6 (const INT32 o[3], INT32 b[2]) const;
+    double clock, rate;
     TrackInfoBasic trkinfo[3];
 
   public:
       NES_VRC6 ();
      ~NES_VRC6 ();
 
+    // rate and mix settings are configuration, not saved state
+    typedef NES_VRC6_State State;
+    void SaveState (State& s) const { s = *this; }
+    void LoadState (const State& s) { static_cast<State&>(*this) = s; }
+
     virtual void Reset ();
     virtual void Tick (UINT32 clocks);
+    UINT32 ClocksUntilLevelChange() override;
     virtual UINT32 Render (INT32 b[2]);
+    void RenderBlock (INT32* b, UINT32 frames, const UINT32* clocks) override;
+    // Each channel's level alone and unpanned, as Render() would mix it with
+    // the other channels silent, into b[0..2]; returns the channel count.
+    // With nonlinear false the channels go through the linear mixer instead.
+    UINT32 RenderChannels (INT32* b, bool nonlinear) const;
     virtual bool Read (UINT32 adr, UINT32 & val, UINT32 id=0);
     virtual bool Write (UINT32 adr, UINT32 val, UINT32 id=0);
     virtual void SetClock (double);
     virtual void SetRate (double);
     virtual void SetOption (int, int);
-    virtual void SetMask (int m){ mask = m; }
+    virtual void SetMask (int m);
     virtual void SetStereoMix (int trk, xgm::INT16 mixl, xgm::INT16 mixr);
     virtual ITrackInfo *GetTrackInfo(int trk);
   };
@@ -14,4 +14,19 @@ namespace xgm {
         }
         return x;
     }
+
+    /// Advances a frequency divider that counts down by `clocks`,
+    /// reloading it with `period` each time it drops below zero.
+    /// Returns the number of reloads, i.e. how many times the
+    /// sequencer behind the divider steps. Constant time, so the
+    /// cost does not grow with pitch or with the span ticked.
+    inline UINT32 count_down_divider(INT32& counter, INT32 period, UINT32 clocks) {
+        assert(period > 0);
+        counter -= clocks;
+        if (counter >= 0)
+            return 0;
+        const UINT32 steps = ((UINT32)-counter + (UINT32)period - 1) / (UINT32)period;
+        counter += (INT32)(steps * (UINT32)period);
+        return steps;
+    }
 }
\ No newline at end of file
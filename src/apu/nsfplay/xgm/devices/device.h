@@ -108,6 +108,30 @@ namespace xgm
         return NSFPLAY_RENDER_STEP;
     }
 
+    /**
+     * Block rendering.
+     *
+     * For each of `frames` output frames, runs Tick(clocks[i]) (skipped when
+     * clocks[i] is 0) followed by Render(), and accumulates the stereo result
+     * into b, which holds frames interleaved left/right pairs.
+     *
+     * The caller must not write registers during the block, and must split
+     * blocks so that no frame sequencer step falls inside one
+     * (see NES_DMC::ClocksUntilFrameSequence()).
+     * Chips override this to run the whole loop without virtual calls.
+     */
+    virtual void RenderBlock (INT32* b, UINT32 frames, const UINT32* clocks)
+    {
+      for (UINT32 i = 0; i < frames; ++i)
+      {
+        if (clocks[i]) Tick (clocks[i]);
+        INT32 o[2] = {0, 0};
+        Render (o);
+        b[2*i] += o[0];
+        b[2*i+1] += o[1];
+      }
+    }
+
     /**
      * チップの動作クロックを設定
      *
@@ -0,0 +1,82 @@
+// BatchRenderer: Renders many MIDI files concurrently
+// GPL-3.0
+
+#include "BatchRenderer.h"
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <memory>
+
+bool BatchRenderer::collectItems(const juce::File &source,
+                                 const juce::File &outputDir,
+                                 std::vector<Item> &items,
+                                 juce::String &error) {
+  auto defaultOutput = [&outputDir](const juce::File &input) {
+    return outputDir.getChildFile(input.getFileNameWithoutExtension() +
+                                  ".wav");
+  };
+
+  if (source.isDirectory()) {
+    auto files = source.findChildFiles(juce::File::findFiles, false,
+                                       "*.mid;*.midi");
+    files.sort();
+    for (const auto &file : files)
+      items.push_back({file, defaultOutput(file)});
+    return true;
+  }
+
+  if (!source.existsAsFile()) {
+    error = "Cannot read " + source.getFullPathName();
+    return false;
+  }
+  juce::StringArray lines;
+  source.readLines(lines);
+
+  const juce::File baseDir = source.getParentDirectory();
+  for (const auto &line : lines) {
+    const juce::String entry = line.trim();
+    if (entry.isEmpty() || entry.startsWithChar('#'))
+      continue;
+
+    const juce::File input =
+        baseDir.getChildFile(entry.upToFirstOccurrenceOf("\t", false, false));
+    const juce::String output =
+        entry.fromFirstOccurrenceOf("\t", false, false).trim();
+    items.push_back({input, output.isEmpty() ? defaultOutput(input)
+                                             : baseDir.getChildFile(output)});
+  }
+  return true;
+}
+
+BatchRenderer::BatchRenderer(const MidiRenderJob::Options &options,
+                             const MidiRenderJob::Settings &settings)
+    : m_options(options), m_settings(settings) {}
+
+std::vector<BatchRenderer::Report>
+BatchRenderer::render(const std::vector<Item> &items, int numThreads) const {
+  std::vector<Report> reports(items.size());
+
+  // Parse every file up front, so the jobs can be dealt longest first
+  std::vector<std::unique_ptr<MidiRenderJob>> jobs(items.size());
+  std::vector<size_t> order;
+  for (size_t i = 0; i < items.size(); ++i) {
+    reports[i].item = items[i];
+    jobs[i] = std::make_unique<MidiRenderJob>(m_options);
+    jobs[i]->setSettings(m_settings);
+    if (jobs[i]->loadMidiFile(items[i].input, reports[i].result.error))
+      order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&jobs](size_t a, size_t b) {
+    return jobs[a]->getLengthInSamples() > jobs[b]->getLengthInSamples();
+  });
+
+  std::vector<WorkStealingPool::Task> tasks;
+  for (size_t i : order) {
+    tasks.push_back([&jobs, &reports, i] {
+      reports[i].result = jobs[i]->render(reports[i].item.output);
+    });
+  }
+
+  WorkStealingPool(numThreads).run(std::move(tasks));
+  return reports;
+}
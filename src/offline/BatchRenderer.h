@@ -0,0 +1,42 @@
+#pragma once
+
+// BatchRenderer: Renders many MIDI files concurrently
+// GPL-3.0
+
+#include "MidiRenderJob.h"
+
+#include <vector>
+
+// Runs one MidiRenderJob per file on a WorkStealingPool. Every job owns its
+// own ChipStack and VoiceAllocator, so jobs share nothing while rendering.
+class BatchRenderer {
+public:
+  struct Item {
+    juce::File input;
+    juce::File output;
+  };
+
+  struct Report {
+    Item item;
+    MidiRenderJob::Result result;
+  };
+
+  // Lists the .mid/.midi files in a directory, or the entries of a manifest
+  // file: one "input.mid" or "input.mid<TAB>output.wav" per line, relative
+  // to the manifest. Outputs default to <outputDir>/<input name>.wav.
+  static bool collectItems(const juce::File &source,
+                           const juce::File &outputDir,
+                           std::vector<Item> &items, juce::String &error);
+
+  BatchRenderer(const MidiRenderJob::Options &options,
+                const MidiRenderJob::Settings &settings);
+
+  // Renders every item, longest first, on numThreads workers (0 = all
+  // cores). Reports are in item order.
+  std::vector<Report> render(const std::vector<Item> &items,
+                             int numThreads = 0) const;
+
+private:
+  MidiRenderJob::Options m_options;
+  MidiRenderJob::Settings m_settings;
+};
@@ -0,0 +1,359 @@
+// MidiRenderJob: Offline rendering of a Standard MIDI File through NessyAPU
+// GPL-3.0
+
+#include "MidiRenderJob.h"
+#include "WorkStealingPool.h"
+
+#include <cmath>
+#include <memory>
+
+// Samples buffered between the render loop and the WAV writer thread
+static constexpr int WRITER_BUFFER_SAMPLES = 1 << 17;
+
+// Longest single process()/fastForward() call
+static constexpr int MAX_ADVANCE_SAMPLES = 1 << 20;
+
+// Segment-parallel rendering: shortest segment worth a thread, and the
+// BANDLIMITED pre-roll that rebuilds Blip_Buffer's filter history
+static constexpr double MIN_SEGMENT_SECONDS = 2.0;
+static constexpr double PREROLL_SECONDS = 0.25;
+
+// Unwraps the AudioProcessor::copyXmlToBinary() format (magic number, string
+// length, UTF-8 XML). Anything else is parsed as plain XML.
+static std::unique_ptr<juce::XmlElement>
+parseState(const juce::MemoryBlock &data) {
+  constexpr juce::uint32 magicXmlNumber = 0x21324356;
+  const auto *bytes = static_cast<const char *>(data.getData());
+
+  if (data.getSize() > 8 &&
+      juce::ByteOrder::littleEndianInt(bytes) == magicXmlNumber) {
+    const size_t length = juce::ByteOrder::littleEndianInt(bytes + 4);
+    if (length == 0 || length > data.getSize() - 8)
+      return nullptr;
+    return juce::parseXML(juce::String::fromUTF8(bytes + 8, (int)length));
+  }
+  return juce::parseXML(data.toString());
+}
+
+MidiRenderJob::MidiRenderJob(const Options &options) : m_options(options) {}
+
+bool MidiRenderJob::loadMidiFile(const juce::File &file, juce::String &error) {
+  juce::FileInputStream in(file);
+  if (!in.openedOk()) {
+    error = "Cannot open " + file.getFullPathName();
+    return false;
+  }
+
+  juce::MidiFile midi;
+  if (!midi.readFrom(in)) {
+    error = file.getFileName() + " is not a Standard MIDI File";
+    return false;
+  }
+  midi.convertTimestampTicksToSeconds();
+
+  m_sequence.clear();
+  for (int track = 0; track < midi.getNumTracks(); ++track)
+    m_sequence.addSequence(*midi.getTrack(track), 0.0);
+  m_sequence.sort();
+  m_sequence.updateMatchedPairs();
+  return true;
+}
+
+bool MidiRenderJob::loadState(const juce::File &file, juce::String &error) {
+  juce::MemoryBlock data;
+  if (!file.loadFileAsData(data)) {
+    error = "Cannot read " + file.getFullPathName();
+    return false;
+  }
+
+  const auto xml = parseState(data);
+  if (xml == nullptr || !xml->hasTagName("NessyParameters")) {
+    error = file.getFileName() + " is not a Nessy state";
+    return false;
+  }
+
+  // AudioProcessorValueTreeState saves <PARAM id="..." value="..."/> with
+  // unnormalised values
+  Settings s;
+  for (auto *param : xml->getChildWithTagNameIterator("PARAM")) {
+    const juce::String id = param->getStringAttribute("id");
+    const double value = param->getDoubleAttribute("value");
+    const int index = juce::roundToInt(value);
+
+    if (id == "masterVolume")
+      s.masterVolume = (float)value;
+    else if (id == "pulse1Enable")
+      s.channelEnabled[0] = index != 0;
+    else if (id == "pulse2Enable")
+      s.channelEnabled[1] = index != 0;
+    else if (id == "triangleEnable")
+      s.channelEnabled[2] = index != 0;
+    else if (id == "noiseEnable")
+      s.channelEnabled[3] = index != 0;
+    else if (id == "pulse1Duty")
+      s.pulseDuty[0] = index;
+    else if (id == "pulse2Duty")
+      s.pulseDuty[1] = index;
+    else if (id == "noiseMode")
+      s.noiseShortMode = index != 0;
+    else if (id == "voiceMode")
+      s.voiceMode = index;
+    else if (id == "splitPoint")
+      s.splitPoint = index;
+    else if (id == "chipCount")
+      s.chipCount = index;
+    else if (id == "vrc6Enable")
+      s.vrc6Enabled = index != 0;
+    else if (id == "vrc6Pulse1Duty")
+      s.vrc6PulseDuty[0] = index;
+    else if (id == "vrc6Pulse2Duty")
+      s.vrc6PulseDuty[1] = index;
+    else if (id == "pulse1Pan")
+      s.channelPan[NessyAPU::PULSE1] = index;
+    else if (id == "pulse2Pan")
+      s.channelPan[NessyAPU::PULSE2] = index;
+    else if (id == "trianglePan")
+      s.channelPan[NessyAPU::TRIANGLE] = index;
+    else if (id == "noisePan")
+      s.channelPan[NessyAPU::NOISE] = index;
+    else if (id == "vrc6Pulse1Pan")
+      s.channelPan[NessyAPU::VRC6_PULSE1] = index;
+    else if (id == "vrc6Pulse2Pan")
+      s.channelPan[NessyAPU::VRC6_PULSE2] = index;
+    else if (id == "vrc6SawPan")
+      s.channelPan[NessyAPU::VRC6_SAW] = index;
+    else if (id == "stemMixer")
+      s.stemNonlinear = index == 0;
+    else if (id == "tuningA4")
+      s.tuning.referenceA4 = value;
+    else if (id == "detuneCents")
+      s.tuning.detuneCents = value;
+    else if (id == "temperament")
+      s.tuning.temperament = static_cast<PeriodTable::Temperament>(index);
+    else if (id == "temperamentRoot")
+      s.tuning.root = index;
+  }
+
+  m_settings = s;
+  return true;
+}
+
+juce::int64 MidiRenderJob::getLengthInSamples() const {
+  const double seconds = m_sequence.getEndTime() + m_options.tailSeconds;
+  return (juce::int64)std::ceil(seconds * m_options.sampleRate);
+}
+
+void MidiRenderJob::preparePlayer(Player &player) const {
+  ChipStack &chips = player.chips;
+  VoiceAllocator &voices = player.voices;
+  voices.setAPUs(chips.getChips(), ChipStack::MAX_CHIPS);
+  chips.initialize(m_options.sampleRate);
+
+  const Settings &s = m_settings;
+  chips.forEachChip([this, &s](NessyAPU &apu) {
+    apu.setRenderMode(m_options.renderMode);
+    apu.setTuning(s.tuning);
+
+    apu.setChannelEnabled(NessyAPU::PULSE1, s.channelEnabled[0]);
+    apu.setChannelEnabled(NessyAPU::PULSE2, s.channelEnabled[1]);
+    apu.setChannelEnabled(NessyAPU::TRIANGLE, s.channelEnabled[2]);
+    apu.setChannelEnabled(NessyAPU::NOISE, s.channelEnabled[3]);
+    apu.setPulseDuty(0, static_cast<NessyAPU::DutyCycle>(s.pulseDuty[0]));
+    apu.setPulseDuty(1, static_cast<NessyAPU::DutyCycle>(s.pulseDuty[1]));
+    apu.setNoiseMode(s.noiseShortMode);
+
+    apu.setVRC6Enabled(s.vrc6Enabled);
+    apu.setVRC6PulseDuty(0, s.vrc6PulseDuty[0]);
+    apu.setVRC6PulseDuty(1, s.vrc6PulseDuty[1]);
+
+    for (int channel = 0; channel < NessyAPU::NUM_CHANNELS; ++channel)
+      apu.setChannelPan(channel, s.channelPan[channel] / 100.0f);
+    apu.setStemNonlinear(s.stemNonlinear);
+  });
+
+  voices.setMode(static_cast<VoiceAllocator::Mode>(s.voiceMode));
+  voices.setSplitPoint(s.splitPoint);
+  voices.setVRC6Enabled(s.vrc6Enabled);
+  voices.setNumChips(s.chipCount);
+  chips.prepareWorkers(s.chipCount);
+  chips.setNumChips(s.chipCount);
+}
+
+void MidiRenderJob::play(Player &player, juce::int64 end, float *left,
+                         float *right) const {
+  auto advanceTo = [&](juce::int64 target) {
+    while (player.position < target) {
+      const int count = (int)juce::jmin(target - player.position,
+                                        (juce::int64)MAX_ADVANCE_SAMPLES);
+      if (left != nullptr) {
+        player.chips.process(left, right, count);
+        left += count;
+        right += count;
+      } else {
+        for (int i = 0; i < player.chips.getNumChips(); ++i)
+          player.chips.getChip(i).fastForward(count);
+      }
+      player.position += count;
+    }
+  };
+
+  // Render up to each event, as processBlock does
+  for (; player.nextEvent < m_sequence.getNumEvents(); ++player.nextEvent) {
+    const auto &message =
+        m_sequence.getEventPointer(player.nextEvent)->message;
+    const auto eventSample = (juce::int64)std::llround(
+        message.getTimeStamp() * m_options.sampleRate);
+    if (eventSample >= end)
+      break;
+    advanceTo(eventSample);
+
+    VoiceAllocator &voices = player.voices;
+    if (message.isNoteOn()) {
+      voices.noteOn(message.getChannel() - 1, message.getNoteNumber(),
+                    message.getFloatVelocity());
+    } else if (message.isNoteOff()) {
+      voices.noteOff(message.getChannel() - 1, message.getNoteNumber());
+    } else if (message.isAllNotesOff() || message.isAllSoundOff()) {
+      voices.allNotesOff();
+    }
+  }
+  advanceTo(end);
+}
+
+void MidiRenderJob::renderSegments(juce::AudioBuffer<float> &buffer,
+                                   int threads) const {
+  WorkStealingPool pool(threads);
+  const juce::int64 total = buffer.getNumSamples();
+  const auto minSegment =
+      (juce::int64)(MIN_SEGMENT_SECONDS * m_options.sampleRate);
+  const int numSegments = (int)juce::jlimit(
+      (juce::int64)1, (juce::int64)pool.getNumWorkers(), total / minSegment);
+
+  const juce::int64 preroll =
+      m_options.renderMode == NessyAPU::RenderMode::BANDLIMITED
+          ? (juce::int64)(PREROLL_SECONDS * m_options.sampleRate)
+          : 0;
+
+  // Serial pass: fast-forward through the song, checkpointing the state
+  // where each segment's pre-roll starts
+  std::vector<juce::int64> starts(numSegments + 1);
+  std::vector<Checkpoint> checkpoints(numSegments);
+  {
+    auto scout = std::make_unique<Player>();
+    preparePlayer(*scout);
+    for (int i = 0; i < numSegments; ++i) {
+      starts[i] = total * i / numSegments;
+      play(*scout, juce::jmax((juce::int64)0, starts[i] - preroll), nullptr,
+           nullptr);
+
+      Checkpoint &checkpoint = checkpoints[i];
+      const size_t stateSize = NessyAPU::getStateSize();
+      const int numChips = scout->chips.getNumChips();
+      checkpoint.apuState.resize(stateSize * numChips);
+      for (int chip = 0; chip < numChips; ++chip)
+        scout->chips.getChip(chip).saveState(checkpoint.apuState.data() +
+                                             stateSize * chip);
+      checkpoint.voices = scout->voices;
+      checkpoint.nextEvent = scout->nextEvent;
+      checkpoint.position = scout->position;
+    }
+    starts[numSegments] = total;
+  }
+
+  float *left = buffer.getWritePointer(0);
+  float *right = buffer.getWritePointer(1);
+
+  std::vector<WorkStealingPool::Task> tasks;
+  for (int i = 0; i < numSegments; ++i) {
+    tasks.push_back([this, left, right, &starts, &checkpoints, i] {
+      const Checkpoint &checkpoint = checkpoints[i];
+      auto player = std::make_unique<Player>();
+      preparePlayer(*player);
+      const size_t stateSize = NessyAPU::getStateSize();
+      for (int chip = 0; chip < player->chips.getNumChips(); ++chip)
+        player->chips.getChip(chip).loadState(checkpoint.apuState.data() +
+                                              stateSize * chip);
+      player->voices = checkpoint.voices;
+      player->voices.setAPUs(player->chips.getChips(), ChipStack::MAX_CHIPS);
+      player->nextEvent = checkpoint.nextEvent;
+      player->position = checkpoint.position;
+
+      // Pre-roll output is discarded
+      const auto prerollSamples = (size_t)(starts[i] - checkpoint.position);
+      std::vector<float> scratch(prerollSamples * 2);
+      play(*player, starts[i], scratch.data(),
+           scratch.data() + prerollSamples);
+
+      play(*player, starts[i + 1], left + starts[i], right + starts[i]);
+    });
+  }
+  pool.run(std::move(tasks));
+}
+
+MidiRenderJob::Result MidiRenderJob::render(const juce::File &output) const {
+  Result result;
+  const double startTime = juce::Time::getMillisecondCounterHiRes();
+
+  output.deleteFile();
+  std::unique_ptr<juce::FileOutputStream> stream(output.createOutputStream());
+  if (stream == nullptr) {
+    result.error = "Cannot write " + output.getFullPathName();
+    return result;
+  }
+
+  juce::WavAudioFormat wav;
+  std::unique_ptr<juce::AudioFormatWriter> writer(
+      wav.createWriterFor(stream.get(), m_options.sampleRate, 2,
+                          m_options.bitsPerSample, {}, 0));
+  if (writer == nullptr) {
+    result.error = "Unsupported WAV format";
+    return result;
+  }
+  stream.release(); // Now owned by the writer
+
+  const juce::int64 total = getLengthInSamples();
+
+  if (m_options.threads != 1) {
+    // Segments finish out of order, so render the song into memory first
+    juce::AudioBuffer<float> buffer(2, (int)total);
+    renderSegments(buffer, m_options.threads);
+    buffer.applyGain(m_settings.masterVolume);
+    if (!writer->writeFromAudioSampleBuffer(buffer, 0, (int)total)) {
+      result.error = "Cannot write " + output.getFullPathName();
+      return result;
+    }
+    writer.reset();
+  } else {
+    auto player = std::make_unique<Player>();
+    preparePlayer(*player);
+
+    const int blockSize =
+        juce::jlimit(1, WRITER_BUFFER_SAMPLES / 2, m_options.blockSize);
+    juce::AudioBuffer<float> buffer(2, blockSize);
+
+    juce::TimeSliceThread writerThread("NessyRender WAV writer");
+    writerThread.startThread();
+    juce::AudioFormatWriter::ThreadedWriter threadedWriter(
+        writer.release(), writerThread, WRITER_BUFFER_SAMPLES);
+
+    for (juce::int64 pos = 0; pos < total; pos += blockSize) {
+      const int numSamples =
+          (int)juce::jmin((juce::int64)blockSize, total - pos);
+      play(*player, pos + numSamples, buffer.getWritePointer(0),
+           buffer.getWritePointer(1));
+      buffer.applyGain(0, numSamples, m_settings.masterVolume);
+
+      // The writer thread drains the FIFO; wait for it when it is full
+      while (!threadedWriter.write(buffer.getArrayOfReadPointers(),
+                                   numSamples))
+        juce::Thread::sleep(1);
+    }
+  } // ThreadedWriter flushes and closes the file here
+
+  result.ok = true;
+  result.samples = total;
+  result.audioSeconds = (double)total / m_options.sampleRate;
+  result.renderSeconds =
+      (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+  return result;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+// MidiRenderJob: Offline rendering of a Standard MIDI File through NessyAPU
+// GPL-3.0
+
+#include "apu/ChipStack.h"
+#include "apu/NessyAPU.h"
+#include "apu/VoiceAllocator.h"
+
+#include <juce_audio_formats/juce_audio_formats.h>
+
+#include <vector>
+
+// Plays a MIDI file through VoiceAllocator/ChipStack the way the plugin's
+// processBlock does (every event on its own sample) and streams the result
+// to a WAV file through a background writer thread.
+//
+// With more than one thread, the song is split into segments that render in
+// parallel. A serial pass fast-forwards through the song without mixing
+// (NessyAPU::fastForward()) and checkpoints the emulator state at each
+// segment start; each segment then restores its checkpoint and renders on
+// its own ChipStack. BANDLIMITED segments start with a pre-roll that rebuilds
+// the filter history, so the stitched output matches a serial render.
+class MidiRenderJob {
+public:
+  struct Options {
+    double sampleRate = 44100.0;
+    int bitsPerSample = 24;
+    int blockSize = 1024;     // Samples rendered per writer push
+    double tailSeconds = 1.0; // Rendered after the last MIDI event
+    NessyAPU::RenderMode renderMode = NessyAPU::RenderMode::BANDLIMITED;
+    int threads = 1; // > 1 renders segments in parallel, 0 = all cores
+  };
+
+  // Plugin parameter values, with the plugin's defaults
+  struct Settings {
+    float masterVolume = 0.8f;
+    bool channelEnabled[4] = {true, true, true, true}; // Pulse 1/2, tri, noise
+    int pulseDuty[2] = {2, 2};                         // 0-3
+    bool noiseShortMode = false;
+    int voiceMode = 0; // VoiceAllocator::Mode
+    int splitPoint = 60;
+    int chipCount = 1; // 1 to ChipStack::MAX_CHIPS
+    bool vrc6Enabled = false;
+    int vrc6PulseDuty[2] = {7, 7};               // 0-7
+    int channelPan[NessyAPU::NUM_CHANNELS] = {}; // -100 to 100, no DMC pan
+    bool stemNonlinear = true;                   // Stems only; not rendered
+    PeriodTable::Tuning tuning;
+  };
+
+  struct Result {
+    bool ok = false;
+    juce::String error;
+    juce::int64 samples = 0;
+    double audioSeconds = 0.0;
+    double renderSeconds = 0.0; // Wall clock, until the WAV is flushed
+
+    double realtimeFactor() const {
+      return renderSeconds > 0.0 ? audioSeconds / renderSeconds : 0.0;
+    }
+  };
+
+  explicit MidiRenderJob(const Options &options = Options());
+
+  // Merges every track of the file into one time-ordered sequence
+  bool loadMidiFile(const juce::File &file, juce::String &error);
+
+  // Reads parameter values from a getStateInformation() blob, or from the
+  // same state saved as plain XML
+  bool loadState(const juce::File &file, juce::String &error);
+
+  const Settings &getSettings() const { return m_settings; }
+  void setSettings(const Settings &settings) { m_settings = settings; }
+
+  // Length of the render in samples, tail included
+  juce::int64 getLengthInSamples() const;
+
+  // Renders the whole sequence into a new WAV file
+  Result render(const juce::File &output) const;
+
+private:
+  // One chip stack and its position in the sequence. Options::threads is
+  // the render's parallelism, so the stack starts no workers of its own.
+  struct Player {
+    ChipStack chips{0};
+    VoiceAllocator voices;
+    int nextEvent = 0;
+    juce::int64 position = 0;
+  };
+
+  // Emulator state at a segment start, one NessyAPU state per active chip
+  struct Checkpoint {
+    std::vector<unsigned char> apuState;
+    VoiceAllocator voices;
+    int nextEvent = 0;
+    juce::int64 position = 0;
+  };
+
+  void preparePlayer(Player &player) const;
+
+  // Plays the events up to sample 'end', rendering into left/right, or
+  // fast-forwarding when left is null
+  void play(Player &player, juce::int64 end, float *left, float *right) const;
+
+  // Renders the whole sequence into buffer, split across threads
+  void renderSegments(juce::AudioBuffer<float> &buffer, int threads) const;
+
+  Options m_options;
+  Settings m_settings;
+  juce::MidiMessageSequence m_sequence;
+};
@@ -0,0 +1,154 @@
+// NessyRender: Command-line MIDI file to WAV renderer
+// GPL-3.0
+//
+// Usage: NessyRender input.mid output.wav [options]
+//        NessyRender --batch <directory|manifest> output-dir [--jobs N]
+//                    [options]
+// Options: [--state FILE] [--rate HZ] [--bits 16|24|32] [--block N]
+//          [--tail SECONDS] [--mode sampled|event|bandlimited]
+//          [--threads N] (single file: render segments in parallel,
+//          0 = all cores)
+
+#include "BatchRenderer.h"
+#include "MidiRenderJob.h"
+
+#include <cstdio>
+
+static int usage(const juce::String &program) {
+  std::fprintf(stderr,
+               "Usage: %s input.mid output.wav [options]\n"
+               "       %s --batch <directory|manifest> output-dir "
+               "[--jobs N] [options]\n"
+               "Options: [--state FILE] [--rate HZ] [--bits 16|24|32] "
+               "[--block N] [--tail SECONDS]\n"
+               "         [--mode sampled|event|bandlimited] [--threads N]\n",
+               program.toRawUTF8(), program.toRawUTF8());
+  return 2;
+}
+
+static int renderBatch(const juce::File &source, const juce::File &outputDir,
+                       const MidiRenderJob::Options &options,
+                       const MidiRenderJob::Settings &settings,
+                       int numThreads) {
+  std::vector<BatchRenderer::Item> items;
+  juce::String error;
+  if (!BatchRenderer::collectItems(source, outputDir, items, error) ||
+      !outputDir.createDirectory()) {
+    std::fprintf(stderr, "%s\n",
+                 error.isEmpty() ? "Cannot create the output directory"
+                                 : error.toRawUTF8());
+    return 1;
+  }
+
+  const double startTime = juce::Time::getMillisecondCounterHiRes();
+  const auto reports = BatchRenderer(options, settings).render(items,
+                                                               numThreads);
+  const double seconds =
+      (juce::Time::getMillisecondCounterHiRes() - startTime) / 1000.0;
+
+  int failures = 0;
+  double audioSeconds = 0.0;
+  for (const auto &report : reports) {
+    if (report.result.ok) {
+      audioSeconds += report.result.audioSeconds;
+      std::printf("%s: %.2f s in %.3f s\n",
+                  report.item.output.getFullPathName().toRawUTF8(),
+                  report.result.audioSeconds, report.result.renderSeconds);
+    } else {
+      ++failures;
+      std::fprintf(stderr, "%s: %s\n",
+                   report.item.input.getFullPathName().toRawUTF8(),
+                   report.result.error.toRawUTF8());
+    }
+  }
+
+  std::printf("Rendered %d of %d files, %.2f s of audio in %.3f s "
+              "(%.0fx realtime)\n",
+              (int)reports.size() - failures, (int)reports.size(),
+              audioSeconds, seconds,
+              seconds > 0.0 ? audioSeconds / seconds : 0.0);
+  return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  juce::ArgumentList args(argc, argv);
+
+  // Positional arguments are the ones that are not an option or its value
+  const juce::StringArray valueOptions{"--state", "--rate",  "--bits",
+                                       "--block", "--tail",  "--jobs",
+                                       "--mode",  "--threads"};
+  juce::StringArray files;
+  for (int i = 0; i < args.size(); ++i) {
+    if (args[i].isOption()) {
+      if (valueOptions.contains(args[i].text))
+        ++i;
+    } else {
+      files.add(args[i].text);
+    }
+  }
+  const bool batch = args.containsOption("--batch");
+  if (files.size() != 2)
+    return usage(args.executableName);
+
+  MidiRenderJob::Options options;
+  if (args.containsOption("--rate"))
+    options.sampleRate = args.getValueForOption("--rate").getDoubleValue();
+  if (args.containsOption("--bits"))
+    options.bitsPerSample = args.getValueForOption("--bits").getIntValue();
+  if (args.containsOption("--block"))
+    options.blockSize = args.getValueForOption("--block").getIntValue();
+  if (args.containsOption("--tail"))
+    options.tailSeconds = args.getValueForOption("--tail").getDoubleValue();
+  if (args.containsOption("--threads"))
+    options.threads = args.getValueForOption("--threads").getIntValue();
+  if (args.containsOption("--mode")) {
+    const juce::String mode = args.getValueForOption("--mode");
+    if (mode == "sampled")
+      options.renderMode = NessyAPU::RenderMode::SAMPLED;
+    else if (mode == "event")
+      options.renderMode = NessyAPU::RenderMode::EVENT_DRIVEN;
+    else if (mode == "bandlimited")
+      options.renderMode = NessyAPU::RenderMode::BANDLIMITED;
+    else
+      return usage(args.executableName);
+  }
+  if (options.sampleRate < 8000.0 || options.tailSeconds < 0.0 ||
+      options.threads < 0)
+    return usage(args.executableName);
+
+  const juce::File cwd = juce::File::getCurrentWorkingDirectory();
+  MidiRenderJob job(options);
+  juce::String error;
+
+  if (args.containsOption("--state") &&
+      !job.loadState(cwd.getChildFile(args.getValueForOption("--state")),
+                     error)) {
+    std::fprintf(stderr, "%s\n", error.toRawUTF8());
+    return 1;
+  }
+
+  // Batches already use every core, one file per thread
+  if (batch) {
+    options.threads = 1;
+    return renderBatch(cwd.getChildFile(files[0]), cwd.getChildFile(files[1]),
+                       options, job.getSettings(),
+                       args.getValueForOption("--jobs").getIntValue());
+  }
+
+  if (!job.loadMidiFile(cwd.getChildFile(files[0]), error)) {
+    std::fprintf(stderr, "%s\n", error.toRawUTF8());
+    return 1;
+  }
+
+  const juce::File output = cwd.getChildFile(files[1]);
+  const MidiRenderJob::Result result = job.render(output);
+  if (!result.ok) {
+    std::fprintf(stderr, "%s\n", result.error.toRawUTF8());
+    return 1;
+  }
+
+  std::printf("Rendered %.2f s of audio to %s in %.3f s (%.0fx realtime)\n",
+              result.audioSeconds, output.getFullPathName().toRawUTF8(),
+              result.renderSeconds, result.realtimeFactor());
+  return 0;
+}
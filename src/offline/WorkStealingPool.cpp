@@ -0,0 +1,67 @@
+// WorkStealingPool: Runs a batch of independent tasks on all cores
+// GPL-3.0
+
+#include "WorkStealingPool.h"
+
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+struct TaskQueue {
+  std::mutex lock;
+  std::deque<WorkStealingPool::Task> tasks;
+};
+
+} // namespace
+
+WorkStealingPool::WorkStealingPool(int numWorkers)
+    : m_numWorkers(numWorkers > 0
+                       ? numWorkers
+                       : std::max(1, (int)std::thread::hardware_concurrency())) {
+}
+
+void WorkStealingPool::run(std::vector<Task> tasks) {
+  const int numWorkers =
+      std::max(1, std::min(m_numWorkers, (int)tasks.size()));
+
+  std::unique_ptr<TaskQueue[]> queues(new TaskQueue[numWorkers]);
+  for (size_t i = 0; i < tasks.size(); ++i)
+    queues[i % numWorkers].tasks.push_back(std::move(tasks[i]));
+
+  auto worker = [&queues, numWorkers](int self) {
+    for (;;) {
+      Task task;
+
+      // Own deque from the front, then steal from the back of the others
+      for (int i = 0; i < numWorkers && !task; ++i) {
+        TaskQueue &queue = queues[(self + i) % numWorkers];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty())
+          continue;
+        if (i == 0) {
+          task = std::move(queue.tasks.front());
+          queue.tasks.pop_front();
+        } else {
+          task = std::move(queue.tasks.back());
+          queue.tasks.pop_back();
+        }
+      }
+
+      // No task is added during a run, so empty deques mean we are done
+      if (!task)
+        return;
+      task();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int i = 1; i < numWorkers; ++i)
+    threads.emplace_back(worker, i);
+  worker(0);
+  for (auto &thread : threads)
+    thread.join();
+}
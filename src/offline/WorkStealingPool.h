@@ -0,0 +1,27 @@
+#pragma once
+
+// WorkStealingPool: Runs a batch of independent tasks on all cores
+// GPL-3.0
+
+#include <functional>
+#include <vector>
+
+// Tasks are dealt round-robin onto one deque per worker. A worker takes
+// from the front of its own deque and, once that is empty, steals from the
+// back of the others', so uneven task lengths still keep every core busy.
+// Deal the longest tasks first for the best balance.
+class WorkStealingPool {
+public:
+  using Task = std::function<void()>;
+
+  // 0 = one worker per hardware thread
+  explicit WorkStealingPool(int numWorkers = 0);
+
+  int getNumWorkers() const { return m_numWorkers; }
+
+  // Runs every task and returns once all of them have finished
+  void run(std::vector<Task> tasks);
+
+private:
+  int m_numWorkers;
+};
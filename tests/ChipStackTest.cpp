@@ -0,0 +1,148 @@
+// ChipStackTest: Voice spreading and parallel rendering of a chip stack
+// GPL-3.0
+//
+// Plays a chord too wide for one chip on a full stack and checks that every
+// note gets a voice, that the stack rendered on worker threads matches the
+// stack rendered serially sample for sample, and that both match the chips
+// rendered one by one and summed. Stacks start workers in the shared pool
+// only once they need them, and two stacks rendering at once on different
+// threads still match the serial render.
+
+#include "ChipStack.h"
+#include "VoiceAllocator.h"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+namespace {
+
+constexpr double SAMPLE_RATE = 48000.0;
+constexpr int NUM_CHIPS = ChipStack::MAX_CHIPS;
+constexpr int BLOCK_SIZES[] = {128, 37, 3000, 1, 512};
+constexpr int NUM_BLOCKS = 40;
+
+// Three notes per chip, and one more that has to steal
+constexpr int NUM_NOTES = NUM_CHIPS * 3 + 1;
+
+struct Stack {
+  explicit Stack(int numWorkers) : chips(numWorkers) {
+    chips.initialize(SAMPLE_RATE);
+    chips.prepareWorkers(NUM_CHIPS);
+    chips.setNumChips(NUM_CHIPS);
+    voices.setAPUs(chips.getChips(), ChipStack::MAX_CHIPS);
+    voices.setNumChips(NUM_CHIPS);
+    for (int i = 0; i < NUM_NOTES; ++i)
+      voices.noteOn(0, 40 + i, 0.4f + 0.02f * i);
+  }
+
+  ChipStack chips;
+  VoiceAllocator voices;
+};
+
+bool testVoices() {
+  Stack stack(0);
+  int held = 0;
+  for (int i = 0; i < NUM_NOTES; ++i)
+    held += stack.voices.getChannelForNote(0, 40 + i) >= 0 ? 1 : 0;
+
+  // The last note stole the first
+  const bool ok = held == NUM_NOTES - 1 &&
+                  stack.voices.getChannelForNote(0, 40) < 0 &&
+                  stack.voices.getChannelForNote(0, 40 + NUM_NOTES - 1) >= 0;
+
+  // Shrinking the stack releases the notes on the chips that drop out
+  stack.voices.setNumChips(1);
+  int remaining = 0;
+  for (int i = 0; i < NUM_NOTES; ++i)
+    remaining += stack.voices.getChannelForNote(0, 40 + i) >= 0 ? 1 : 0;
+
+  const bool shrunk = remaining == 3;
+  std::printf("%s voices: %d of %d held, %d after shrinking to one chip\n",
+              ok && shrunk ? "ok  " : "FAIL", held, NUM_NOTES, remaining);
+  return ok && shrunk;
+}
+
+bool testRender() {
+  Stack serial(0), parallel(3), separate(0);
+
+  std::vector<float> serialL, serialR, parallelL, parallelR, sumL, sumR;
+  std::vector<float> chipL, chipR;
+  for (int b = 0; b < NUM_BLOCKS; ++b) {
+    const int n = BLOCK_SIZES[b % (sizeof(BLOCK_SIZES) / sizeof(int))];
+    const size_t at = serialL.size();
+    for (auto *v : {&serialL, &serialR, &parallelL, &parallelR, &sumL, &sumR})
+      v->resize(at + n, 0.0f);
+
+    serial.chips.process(&serialL[at], &serialR[at], n);
+    parallel.chips.process(&parallelL[at], &parallelR[at], n);
+
+    chipL.resize(n);
+    chipR.resize(n);
+    for (int c = 0; c < NUM_CHIPS; ++c) {
+      separate.chips.getChip(c).process(chipL.data(), chipR.data(), n);
+      for (int i = 0; i < n; ++i) {
+        sumL[at + i] = c == 0 ? chipL[i] : sumL[at + i] + chipL[i];
+        sumR[at + i] = c == 0 ? chipR[i] : sumR[at + i] + chipR[i];
+      }
+    }
+  }
+
+  auto same = [](const std::vector<float> &a, const std::vector<float> &b) {
+    return std::memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0;
+  };
+  const bool ok = same(serialL, parallelL) && same(serialR, parallelR) &&
+                  same(serialL, sumL) && same(serialR, sumR);
+
+  std::printf("%s render: %zu samples on %d chips, %d workers\n",
+              ok ? "ok  " : "FAIL", serialL.size(), NUM_CHIPS,
+              parallel.chips.getNumWorkers());
+  return ok;
+}
+
+// Renders NUM_BLOCKS blocks of 256 samples into left/right
+void renderBlocks(Stack &stack, std::vector<float> &left,
+                  std::vector<float> &right) {
+  constexpr int n = 256;
+  left.resize(n * NUM_BLOCKS);
+  right.resize(n * NUM_BLOCKS);
+  for (int b = 0; b < NUM_BLOCKS; ++b)
+    stack.chips.process(&left[b * n], &right[b * n], n);
+}
+
+bool testSharedPool() {
+  // Below PARALLEL_MIN_CHIPS nothing is started
+  ChipStack small(3);
+  small.prepareWorkers(ChipStack::PARALLEL_MIN_CHIPS - 1);
+  small.setNumChips(ChipStack::PARALLEL_MIN_CHIPS - 1);
+  const bool lazy = small.getNumWorkers() == 0;
+
+  // Two stacks share the pool; the one that finds it busy renders serially
+  Stack serial(0), first(3), second(3);
+  std::vector<float> serialL, serialR, firstL, firstR, secondL, secondR;
+  renderBlocks(serial, serialL, serialR);
+  std::thread other([&] { renderBlocks(second, secondL, secondR); });
+  renderBlocks(first, firstL, firstR);
+  other.join();
+
+  const int poolWorkers = RealtimeWorkerPool::shared().getNumWorkers();
+  const bool ok = lazy && first.chips.getNumWorkers() == 3 &&
+                  poolWorkers == 3 && serialL == firstL &&
+                  serialR == firstR && serialL == secondL &&
+                  serialR == secondR;
+  std::printf("%s shared pool: %d workers for two stacks, none for %d "
+              "chips\n",
+              ok ? "ok  " : "FAIL", poolWorkers,
+              ChipStack::PARALLEL_MIN_CHIPS - 1);
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  bool ok = testVoices();
+  ok = testRender() && ok;
+  ok = testSharedPool() && ok;
+  return ok ? 0 : 1;
+}
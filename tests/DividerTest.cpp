@@ -0,0 +1,123 @@
+// DividerTest: Checks the closed-form frequency dividers against the
+// one-reload-at-a-time loops they replaced
+// GPL-3.0
+
+#include "nsfplay/xgm/devices/Sound/nes_vrc6.h"
+#include "nsfplay/xgm/devices/Sound/nsfplay_math.h"
+
+#include <cstdio>
+
+namespace {
+
+using xgm::INT32;
+using xgm::NES_VRC6;
+using xgm::UINT32;
+
+UINT32 g_seed = 777;
+
+UINT32 next() {
+  g_seed = g_seed * 1664525u + 1013904223u;
+  return g_seed >> 8;
+}
+
+// Tick lengths from a few clocks up to far past every period
+UINT32 randomClocks() {
+  switch (next() % 3) {
+  case 0:
+    return next() % 8;
+  case 1:
+    return next() % 500;
+  default:
+    return next() % 200000;
+  }
+}
+
+// The pulse and triangle divider (NES_APU, NES_DMC)
+bool testCountDown() {
+  int mismatches = 0;
+  const int NUM_CALLS = 200000;
+  for (int i = 0; i < NUM_CALLS; ++i) {
+    const INT32 period = 1 + static_cast<INT32>(next() % 0x800);
+    const INT32 start = static_cast<INT32>(next() % period);
+    const UINT32 clocks = randomClocks();
+
+    INT32 counter = start;
+    const UINT32 steps = xgm::count_down_divider(counter, period, clocks);
+
+    INT32 refCounter = start - static_cast<INT32>(clocks);
+    UINT32 refSteps = 0;
+    while (refCounter < 0) {
+      ++refSteps;
+      refCounter += period;
+    }
+    if (steps != refSteps || counter != refCounter)
+      ++mismatches;
+  }
+  std::printf("%s count-down divider: %d calls, %d mismatches\n",
+              mismatches ? "FAIL" : "ok  ", NUM_CALLS, mismatches);
+  return mismatches == 0;
+}
+
+// The VRC6 count-up dividers and the saw's 14-step accumulator, through
+// NES_VRC6::Tick(), against the old loops run on a copy of its state
+bool testVRC6() {
+  NES_VRC6 vrc6;
+  vrc6.Reset();
+  vrc6.Write(0x9000, 0x3F);
+  vrc6.Write(0xA000, 0x5A);
+
+  int mismatches = 0;
+  const int NUM_TICKS = 100000;
+  for (int i = 0; i < NUM_TICKS; ++i) {
+    if (i % 100 == 0) {
+      for (UINT32 base : {0x9000u, 0xA000u, 0xB000u}) {
+        vrc6.Write(base + 1, next() & 0xFF);
+        vrc6.Write(base + 2, 0x80 | (next() & 0x0F));
+      }
+      vrc6.Write(0xB000, next() & 0x3F);
+      vrc6.Write(0x9003, (next() % 4 == 0) ? 0x02 : 0x00);
+    }
+
+    NES_VRC6::State before, after;
+    vrc6.SaveState(before);
+    const UINT32 clocks = randomClocks();
+    vrc6.Tick(clocks);
+    vrc6.SaveState(after);
+
+    NES_VRC6::State ref = before;
+    for (int c = 0; c < 3; ++c) {
+      if (!ref.enable[c] || ref.halt)
+        continue;
+      ref.counter[c] += clocks;
+      while (ref.counter[c] > ref.freq2[c]) {
+        ref.counter[c] -= ref.freq2[c] + 1;
+        if (c < 2) {
+          ref.phase[c] = (ref.phase[c] + 1) & 15;
+        } else if (++ref.count14 >= 14) {
+          ref.count14 = 0;
+          ref.phase[2] = 0;
+        } else if ((ref.count14 & 1) == 0) {
+          ref.phase[2] = (ref.phase[2] + ref.volume[2]) & 0xFF;
+        }
+      }
+    }
+
+    bool same = ref.count14 == after.count14;
+    for (int c = 0; c < 3; ++c)
+      same = same && ref.counter[c] == after.counter[c] &&
+             ref.phase[c] == after.phase[c];
+    if (!same)
+      ++mismatches;
+  }
+  std::printf("%s VRC6 dividers and saw: %d ticks, %d mismatches\n",
+              mismatches ? "FAIL" : "ok  ", NUM_TICKS, mismatches);
+  return mismatches == 0;
+}
+
+} // namespace
+
+int main() {
+  bool ok = testCountDown();
+  ok = testVRC6() && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// EventQueueTest: Timestamped register writes against split rendering
+// GPL-3.0
+//
+// Renders the same note sequence two ways: the old way, splitting process()
+// at every event and writing immediately, and through the write queue, with
+// setEventOffset() and one process() call per block. Both put each write on
+// the same CPU clock, so the output must match in every render mode, with
+// blocks longer than the Blip_Buffers' 250 ms too.
+
+#include "NessyAPU.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr double SAMPLE_RATE = 44100.0;
+constexpr int BLOCK = 512;
+constexpr int NUM_BLOCKS = 48;
+constexpr int LONG_BLOCK = 16384; // About 370 ms
+constexpr int NUM_LONG_BLOCKS = 6;
+
+struct Event {
+  int offset; // Samples into its block
+  int channel;
+  int note; // -1 = note off
+};
+
+// A few events per 512 samples on every channel, some sharing an offset
+std::vector<Event> eventsForBlock(int block, int blockSize) {
+  std::vector<Event> events;
+  uint32_t seed = 2654435761u * static_cast<uint32_t>(block + 1);
+  const int numEvents = (1 + block % 4) * std::max(1, blockSize / BLOCK);
+  for (int i = 0; i < numEvents; ++i) {
+    seed = seed * 1664525u + 1013904223u;
+    const int offset = static_cast<int>((seed >> 8) % blockSize);
+    const int channel = static_cast<int>((seed >> 3) % 8);
+    const int note = (seed >> 20) % 5 == 0 ? -1 : 36 + (seed >> 12) % 48;
+    events.push_back({offset, channel == NessyAPU::DMC ? 0 : channel, note});
+  }
+  std::stable_sort(events.begin(), events.end(),
+                   [](const Event &a, const Event &b) {
+                     return a.offset < b.offset;
+                   });
+  return events;
+}
+
+void play(NessyAPU &apu, const Event &e) {
+  if (e.note < 0)
+    apu.noteOff(e.channel);
+  else
+    apu.noteOn(e.channel, e.note, 0.7f);
+}
+
+bool testMode(NessyAPU::RenderMode mode, int blockSize, int numBlocks) {
+  NessyAPU split, queued;
+  for (NessyAPU *apu : {&split, &queued}) {
+    apu->initialize(SAMPLE_RATE);
+    apu->setRenderMode(mode);
+    apu->setVRC6Enabled(true);
+  }
+
+  std::vector<float> expected(blockSize * numBlocks), actual(expected.size());
+  std::vector<float> right(blockSize);
+
+  for (int b = 0; b < numBlocks; ++b) {
+    const auto events = eventsForBlock(b, blockSize);
+    float *out = expected.data() + b * blockSize;
+
+    int rendered = 0;
+    for (const Event &e : events) {
+      if (e.offset > rendered) {
+        split.process(out + rendered, right.data(), e.offset - rendered);
+        rendered = e.offset;
+      }
+      play(split, e);
+    }
+    split.process(out + rendered, right.data(), blockSize - rendered);
+
+    for (const Event &e : events) {
+      queued.setEventOffset(e.offset);
+      play(queued, e);
+    }
+    queued.process(actual.data() + b * blockSize, right.data(), blockSize);
+  }
+
+  const float diff = maxDiff(expected, actual);
+  const bool ok = diff == 0.0f;
+  std::printf("%s %-13s block %5d max diff %g\n", ok ? "ok  " : "FAIL",
+              modeName(mode), blockSize, diff);
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  bool ok = true;
+  for (auto mode : RENDER_MODES)
+    ok = testMode(mode, BLOCK, NUM_BLOCKS) &&
+         testMode(mode, LONG_BLOCK, NUM_LONG_BLOCKS) && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,355 @@
+// GoldenTests: Golden-audio regression tests for NessyAPU::process
+// GPL-3.0
+//
+// Replays scripted note and register sequences through NessyAPU at several
+// sample rates and compares the output against tests/golden/reference.txt.
+// The sampled render path must stay bit-exact and is checked by hash. The
+// event-driven and bandlimited paths may legitimately change with chip
+// scheduling or filtering, so they are checked against stored RMS envelopes
+// within a tolerance, and the measured deviation is reported.
+//
+// Usage: NessyGoldenTests --reference FILE [--update]
+
+#include "NessyAPU.h"
+#include "TestUtil.h"
+#include "VoiceAllocator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace {
+
+// Largest per-window RMS deviation accepted on the tolerance-checked paths
+constexpr double ENVELOPE_TOLERANCE = 0.005;
+constexpr int ENVELOPE_WINDOW = 1024; // samples
+
+constexpr double SAMPLE_RATES[] = {44100.0, 48000.0, 96000.0};
+
+// Varying block sizes exercise the chunking and event splitting code
+constexpr int BLOCK_SIZES[] = {64, 480, 1000, 37, 256};
+
+struct Player {
+  NessyAPU &apu;
+  VoiceAllocator &voices;
+};
+
+// An action at a time in milliseconds, so scripts are rate-independent
+struct Event {
+  double ms;
+  std::function<void(Player &)> action;
+};
+
+struct Script {
+  const char *name;
+  double lengthMs;
+  std::vector<Event> events;
+};
+
+std::vector<Script> makeScripts() {
+  std::vector<Script> scripts;
+
+  // 2A03 pulses: duty changes, a held note, a sweep and a decaying envelope
+  scripts.push_back(
+      {"pulses",
+       1000.0,
+       {{0.0, [](Player &p) { p.apu.noteOn(NessyAPU::PULSE1, 60, 0.8f); }},
+        {50.0, [](Player &p) { p.apu.noteOn(NessyAPU::PULSE2, 67, 0.6f); }},
+        {200.0,
+         [](Player &p) { p.apu.setPulseDuty(0, NessyAPU::DUTY_12_5); }},
+        {300.0, [](Player &p) { p.apu.setPulseDuty(1, NessyAPU::DUTY_75); }},
+        {400.0, [](Player &p) { p.apu.noteOff(NessyAPU::PULSE1); }},
+        {450.0,
+         [](Player &p) {
+           // Downward sweep on pulse 1
+           p.apu.writeRegister(0x4000, 0xBF);
+           p.apu.writeRegister(0x4001, 0x9A);
+           p.apu.writeRegister(0x4002, 0x80);
+           p.apu.writeRegister(0x4003, 0x01);
+         }},
+        {700.0,
+         [](Player &p) {
+           // Decaying envelope with a length counter on pulse 2
+           p.apu.writeRegister(0x4004, 0x84);
+           p.apu.writeRegister(0x4006, 0x40);
+           p.apu.writeRegister(0x4007, 0x19);
+         }},
+        {950.0, [](Player &p) { p.apu.noteOff(NessyAPU::PULSE2); }}}});
+
+  // Triangle, noise in both modes and $4011 DAC writes
+  scripts.push_back(
+      {"triangle_noise",
+       1000.0,
+       {{0.0, [](Player &p) { p.apu.noteOn(NessyAPU::TRIANGLE, 45, 1.0f); }},
+        {100.0, [](Player &p) { p.apu.noteOn(NessyAPU::NOISE, 100, 0.7f); }},
+        {250.0, [](Player &p) { p.apu.setNoiseMode(true); }},
+        {400.0, [](Player &p) { p.apu.noteOn(NessyAPU::NOISE, 30, 0.5f); }},
+        {500.0, [](Player &p) { p.apu.noteOn(NessyAPU::TRIANGLE, 84, 1.0f); }},
+        {600.0, [](Player &p) { p.apu.setNoiseMode(false); }},
+        {650.0, [](Player &p) { p.apu.writeRegister(0x4011, 0x60); }},
+        {700.0, [](Player &p) { p.apu.writeRegister(0x4011, 0x10); }},
+        {800.0, [](Player &p) { p.apu.noteOff(NessyAPU::TRIANGLE); }},
+        {900.0, [](Player &p) { p.apu.noteOff(NessyAPU::NOISE); }}}});
+
+  // VRC6 pulses and saw
+  scripts.push_back(
+      {"vrc6",
+       1000.0,
+       {{0.0, [](Player &p) { p.apu.setVRC6Enabled(true); }},
+        {0.0,
+         [](Player &p) { p.apu.noteOn(NessyAPU::VRC6_PULSE1, 64, 0.9f); }},
+        {100.0,
+         [](Player &p) { p.apu.noteOn(NessyAPU::VRC6_PULSE2, 71, 0.5f); }},
+        {200.0, [](Player &p) { p.apu.noteOn(NessyAPU::VRC6_SAW, 40, 1.0f); }},
+        {300.0, [](Player &p) { p.apu.setVRC6PulseDuty(0, 1); }},
+        {400.0, [](Player &p) { p.apu.setVRC6PulseDuty(1, 6); }},
+        {500.0, [](Player &p) { p.apu.noteOn(NessyAPU::PULSE1, 52, 0.6f); }},
+        {700.0, [](Player &p) { p.apu.noteOff(NessyAPU::VRC6_PULSE1); }},
+        {800.0, [](Player &p) { p.apu.noteOff(NessyAPU::VRC6_SAW); }},
+        {900.0, [](Player &p) { p.apu.setVRC6Enabled(false); }}}});
+
+  // Dense arpeggios through the voice allocator in each mode
+  Script arpeggio{"arpeggio", 1200.0, {}};
+  arpeggio.events.push_back({0.0, [](Player &p) {
+                               p.apu.setVRC6Enabled(true);
+                               p.voices.setVRC6Enabled(true);
+                             }});
+  auto arpeggioNote = [](int i) {
+    static constexpr int notes[] = {48, 52, 55, 60, 64, 67, 72, 76};
+    return notes[i % 8] + (i / 32) * 2;
+  };
+  for (int i = 0; i < 96; ++i) {
+    const double ms = i * 12.5;
+    const int note = arpeggioNote(i);
+    if (i == 32)
+      arpeggio.events.push_back({ms, [](Player &p) {
+                                   p.voices.setMode(
+                                       VoiceAllocator::Mode::PITCH_SPLIT);
+                                 }});
+    if (i == 64)
+      arpeggio.events.push_back({ms, [](Player &p) {
+                                   p.voices.setMode(
+                                       VoiceAllocator::Mode::UNISON);
+                                 }});
+    arpeggio.events.push_back({ms, [note, i](Player &p) {
+                                 p.voices.noteOn(0, note,
+                                                 0.4f + (i % 5) * 0.1f);
+                               }});
+    if (i >= 3) {
+      const int old = arpeggioNote(i - 3);
+      arpeggio.events.push_back(
+          {ms + 1.0, [old](Player &p) { p.voices.noteOff(0, old); }});
+    }
+  }
+  arpeggio.events.push_back(
+      {1150.0, [](Player &p) { p.voices.allNotesOff(); }});
+  scripts.push_back(std::move(arpeggio));
+
+  return scripts;
+}
+
+// Renders a script the way the plugin does: blocks split at event offsets
+std::vector<float> render(const Script &script, NessyAPU::RenderMode mode,
+                          double sampleRate) {
+  NessyAPU apu;
+  VoiceAllocator voices;
+  voices.setAPU(&apu);
+  apu.initialize(sampleRate);
+  apu.setRenderMode(mode);
+  Player player{apu, voices};
+
+  const int total = static_cast<int>(script.lengthMs * sampleRate / 1000.0);
+  std::vector<float> left(static_cast<size_t>(total));
+  std::vector<float> right(static_cast<size_t>(total));
+
+  auto eventSample = [&](size_t i) {
+    return static_cast<int>(script.events[i].ms * sampleRate / 1000.0);
+  };
+
+  size_t nextEvent = 0;
+  int pos = 0;
+  for (int block = 0; pos < total; ++block) {
+    const int blockEnd =
+        std::min(total, pos + BLOCK_SIZES[block % std::size(BLOCK_SIZES)]);
+    while (pos < blockEnd) {
+      while (nextEvent < script.events.size() && eventSample(nextEvent) <= pos)
+        script.events[nextEvent++].action(player);
+
+      int until = blockEnd;
+      if (nextEvent < script.events.size())
+        until = std::min(until, eventSample(nextEvent));
+      apu.process(left.data() + pos, right.data() + pos, until - pos);
+      pos = until;
+    }
+  }
+  return left;
+}
+
+uint64_t hashSamples(const std::vector<float> &samples) {
+  // FNV-1a over the raw float bits
+  uint64_t h = 1469598103934665603ull;
+  for (float s : samples) {
+    uint32_t bits;
+    std::memcpy(&bits, &s, sizeof bits);
+    for (int i = 0; i < 4; ++i) {
+      h ^= (bits >> (i * 8)) & 0xFF;
+      h *= 1099511628211ull;
+    }
+  }
+  return h;
+}
+
+std::vector<double> envelope(const std::vector<float> &samples) {
+  std::vector<double> env;
+  for (size_t start = 0; start < samples.size(); start += ENVELOPE_WINDOW) {
+    const size_t end = std::min(samples.size(), start + ENVELOPE_WINDOW);
+    double sum = 0.0;
+    for (size_t i = start; i < end; ++i)
+      sum += static_cast<double>(samples[i]) * samples[i];
+    env.push_back(std::sqrt(sum / static_cast<double>(end - start)));
+  }
+  return env;
+}
+
+// Reference file: one "key value..." line per render
+using Reference = std::map<std::string, std::string>;
+
+bool loadReference(const std::string &path, Reference &reference) {
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    const auto space = line.find(' ');
+    if (space != std::string::npos)
+      reference[line.substr(0, space)] = line.substr(space + 1);
+  }
+  return true;
+}
+
+bool saveReference(const std::string &path, const Reference &reference) {
+  std::ofstream out(path);
+  if (!out)
+    return false;
+  out << "# Golden renders for NessyGoldenTests. Regenerate with --update.\n"
+         "# <script>/<mode>/<rate> <hash> or <rms per "
+      << ENVELOPE_WINDOW << "-sample window...>\n";
+  for (const auto &[key, value] : reference)
+    out << key << ' ' << value << '\n';
+  return static_cast<bool>(out);
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  std::string referencePath;
+  bool update = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "--update"))
+      update = true;
+    else if (!std::strcmp(argv[i], "--reference") && i + 1 < argc)
+      referencePath = argv[++i];
+  }
+  if (referencePath.empty()) {
+    std::fprintf(stderr, "Usage: %s --reference FILE [--update]\n", argv[0]);
+    return 2;
+  }
+
+  Reference reference;
+  if (!loadReference(referencePath, reference) && !update) {
+    std::fprintf(stderr, "Cannot read %s\n", referencePath.c_str());
+    return 1;
+  }
+
+  const NessyAPU::RenderMode modes[] = {NessyAPU::RenderMode::SAMPLED,
+                                        NessyAPU::RenderMode::EVENT_DRIVEN,
+                                        NessyAPU::RenderMode::BANDLIMITED};
+  int failures = 0;
+
+  for (const auto &script : makeScripts()) {
+    for (auto mode : modes) {
+      for (double rate : SAMPLE_RATES) {
+        char key[128];
+        std::snprintf(key, sizeof key, "%s/%s/%.0f", script.name,
+                      modeName(mode), rate);
+        const std::vector<float> out = render(script, mode, rate);
+
+        std::ostringstream actual;
+        if (mode == NessyAPU::RenderMode::SAMPLED) {
+          char hash[17];
+          std::snprintf(hash, sizeof hash, "%016llx",
+                        static_cast<unsigned long long>(hashSamples(out)));
+          actual << hash;
+        } else {
+          char value[32];
+          for (double rms : envelope(out)) {
+            std::snprintf(value, sizeof value, "%.6f ", rms);
+            actual << value;
+          }
+        }
+        std::string actualText = actual.str();
+        if (!actualText.empty() && actualText.back() == ' ')
+          actualText.pop_back();
+
+        if (update) {
+          reference[key] = actualText;
+          continue;
+        }
+
+        const auto found = reference.find(key);
+        if (found == reference.end()) {
+          std::printf("FAIL %-36s no reference\n", key);
+          ++failures;
+        } else if (mode == NessyAPU::RenderMode::SAMPLED) {
+          const bool ok = found->second == actualText;
+          std::printf("%s %-36s hash %s (expected %s)\n", ok ? "ok  " : "FAIL",
+                      key, actualText.c_str(), found->second.c_str());
+          failures += ok ? 0 : 1;
+        } else {
+          std::istringstream expectedIn(found->second);
+          std::istringstream actualIn(actualText);
+          std::vector<double> expected, measured;
+          for (double v; expectedIn >> v;)
+            expected.push_back(v);
+          for (double v; actualIn >> v;)
+            measured.push_back(v);
+
+          double maxDeviation = 0.0;
+          for (size_t i = 0; i < std::min(expected.size(), measured.size());
+               ++i)
+            maxDeviation =
+                std::max(maxDeviation, std::abs(expected[i] - measured[i]));
+          const bool ok = expected.size() == measured.size() &&
+                          maxDeviation <= ENVELOPE_TOLERANCE;
+          std::printf("%s %-36s envelope max deviation %.6f (tolerance %.3f)\n",
+                      ok ? "ok  " : "FAIL", key, maxDeviation,
+                      ENVELOPE_TOLERANCE);
+          failures += ok ? 0 : 1;
+        }
+      }
+    }
+  }
+
+  if (update) {
+    if (!saveReference(referencePath, reference)) {
+      std::fprintf(stderr, "Cannot write %s\n", referencePath.c_str());
+      return 1;
+    }
+    std::printf("Wrote %zu references to %s\n", reference.size(),
+                referencePath.c_str());
+    return 0;
+  }
+
+  std::printf("%d failure(s)\n", failures);
+  return failures == 0 ? 0 : 1;
+}
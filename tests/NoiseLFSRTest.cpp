@@ -0,0 +1,131 @@
+// NoiseLFSRTest: Checks NES_DMC's noise fast path against the one tick at a
+// time loop it replaced
+// GPL-3.0
+
+#include "nsfplay/xgm/devices/Sound/nes_dmc.h"
+
+#include <cstdio>
+
+namespace {
+
+using xgm::INT32;
+using xgm::NES_DMC;
+using xgm::UINT32;
+
+constexpr UINT32 VOLUME = 10;
+
+// The old calc_noise(): ticks the shift register once per nfreq clocks and
+// box-filters the output over the interval
+struct ReferenceNoise {
+  UINT32 noise = 1;
+  UINT32 tap = 1 << 1;
+  INT32 counter = 0;
+  UINT32 nfreq = 0;
+
+  UINT32 calc(UINT32 clocks) {
+    UINT32 last = (noise & 0x4000) ? 0 : VOLUME;
+    if (clocks < 1)
+      return last;
+
+    UINT32 count = 0;
+    UINT32 accum = counter * last;
+    UINT32 accum_clocks = counter;
+    counter -= clocks;
+    while (counter < 0) {
+      UINT32 feedback = (noise & 1) ^ ((noise & tap) ? 1 : 0);
+      noise = (noise >> 1) | (feedback << 14);
+      last = (noise & 0x4000) ? 0 : VOLUME;
+      accum += last * nfreq;
+      counter += nfreq;
+      ++count;
+      accum_clocks += nfreq;
+    }
+    if (count < 1)
+      return last;
+
+    accum -= last * counter;
+    accum_clocks -= counter;
+    return accum / accum_clocks;
+  }
+};
+
+UINT32 g_seed = 12345;
+
+UINT32 next() {
+  g_seed = g_seed * 1664525u + 1013904223u;
+  return g_seed >> 8;
+}
+
+// Tick lengths from a sample at high rates up to far past both periods
+UINT32 randomClocks() {
+  switch (next() % 4) {
+  case 0:
+    return 1 + next() % 16;
+  case 1:
+    return 1 + next() % 200;
+  case 2:
+    return 1 + next() % 5000;
+  default:
+    return 1 + next() % 300000;
+  }
+}
+
+bool testTicks() {
+  NES_DMC dmc;
+  dmc.SetOption(NES_DMC::OPT_RANDOMIZE_NOISE, 0);
+  dmc.SetOption(NES_DMC::OPT_RANDOMIZE_TRI, 0);
+  dmc.Reset();
+  dmc.Write(0x4015, 0x08);
+  dmc.Write(0x400C, 0x30 | VOLUME);
+  dmc.Write(0x400F, 0x08);
+
+  ReferenceNoise ref;
+  int mismatches = 0;
+  const int NUM_TICKS = 50000;
+  for (int i = 0; i < NUM_TICKS; ++i) {
+    if (i % 200 == 0) {
+      const UINT32 value = next() & 0x8F;
+      dmc.Write(0x400E, value);
+      ref.tap = (value & 0x80) ? (1 << 6) : (1 << 1);
+      ref.nfreq = NES_DMC::wavlen_table[0][value & 15];
+    }
+
+    const UINT32 clocks = randomClocks();
+    dmc.Tick(clocks);
+    const UINT32 expected = ref.calc(clocks);
+    if (dmc.out[1] != expected || dmc.noise != ref.noise ||
+        dmc.counter[1] != ref.counter) {
+      if (mismatches++ < 5)
+        std::printf("  tick %d (%u clocks): out %u/%u, state %04X/%04X\n", i,
+                    clocks, dmc.out[1], expected, dmc.noise, ref.noise);
+    }
+  }
+
+  std::printf("%s %d ticks, %d mismatches\n", mismatches ? "FAIL" : "ok  ",
+              NUM_TICKS, mismatches);
+  return mismatches == 0;
+}
+
+// The fast path reduces short mode spans modulo 93 ticks
+bool testShortPeriod() {
+  int wrong = 0;
+  for (UINT32 start = 0; start < 0x8000; ++start) {
+    UINT32 s = start;
+    for (int i = 0; i < 93; ++i) {
+      UINT32 feedback = (s & 1) ^ ((s >> 6) & 1);
+      s = (s >> 1) | (feedback << 14);
+    }
+    wrong += s != start ? 1 : 0;
+  }
+  std::printf("%s short mode states back after 93 ticks: %d wrong\n",
+              wrong ? "FAIL" : "ok  ", wrong);
+  return wrong == 0;
+}
+
+} // namespace
+
+int main() {
+  bool ok = testShortPeriod();
+  ok = testTicks() && ok;
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,101 @@
+// OutputStageTest: Float conversion, clipping and the output gain ramp
+// GPL-3.0
+//
+// Checks the vector output stage against the scalar formula it fuses:
+// unity gain matches the old level / 8192 clamp exactly, a gain change
+// ramps linearly over the ramp length and then holds the new gain, and odd
+// block sizes split across the ramp give the same samples as one block.
+
+#include "OutputStage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr double SAMPLE_RATE = 48000.0;
+constexpr float SCALE = 1.0f / 8192.0f;
+constexpr int NUM_SAMPLES = 4000;
+
+int g_failures = 0;
+
+void expect(bool condition, const char *what) {
+  std::printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+  if (!condition)
+    ++g_failures;
+}
+
+// Interleaved levels, some past full scale, on the even slots
+std::vector<int32_t> makeLevels() {
+  std::vector<int32_t> levels(NUM_SAMPLES * 2);
+  for (int i = 0; i < NUM_SAMPLES; ++i) {
+    levels[i * 2] = static_cast<int32_t>(
+        12000.0 * std::sin(i * 0.013) + 3000.0 * std::sin(i * 0.31));
+    levels[i * 2 + 1] = -1; // Must be skipped
+  }
+  return levels;
+}
+
+float clipped(int32_t level) {
+  return std::clamp(static_cast<float>(level) / 8192.0f, -1.0f, 1.0f);
+}
+
+} // namespace
+
+int main() {
+  const std::vector<int32_t> levels = makeLevels();
+  std::vector<float> left(NUM_SAMPLES), right(NUM_SAMPLES);
+
+  OutputStage stage;
+  stage.prepare(SAMPLE_RATE);
+  stage.write(levels.data(), 2, SCALE, left.data(), right.data(), NUM_SAMPLES);
+  bool exact = true;
+  for (int i = 0; i < NUM_SAMPLES; ++i)
+    exact = exact && left[i] == clipped(levels[i * 2]) && right[i] == left[i];
+  expect(exact, "unity gain matches the clamped level / 8192 exactly");
+
+  // Ramp to half gain, rendered in uneven blocks
+  const int rampLength =
+      static_cast<int>(SAMPLE_RATE * OutputStage::RAMP_SECONDS);
+  stage.setGain(0.5f);
+  const int blocks[] = {7, 130, 1, 513, 64};
+  int at = 0;
+  for (int b = 0; at < NUM_SAMPLES; ++b) {
+    const int n = std::min(blocks[b % 5], NUM_SAMPLES - at);
+    stage.write(levels.data() + at * 2, 2, SCALE, left.data() + at,
+                right.data() + at, n);
+    at += n;
+  }
+
+  float maxError = 0.0f;
+  for (int i = 0; i < NUM_SAMPLES; ++i) {
+    const float gain =
+        i < rampLength ? 1.0f - 0.5f * static_cast<float>(i) / rampLength
+                       : 0.5f;
+    maxError = std::max(maxError,
+                        std::fabs(left[i] - clipped(levels[i * 2]) * gain));
+  }
+  expect(maxError < 1e-5f, "a gain change ramps linearly to the new gain");
+
+  bool held = true;
+  for (int i = rampLength; i < NUM_SAMPLES; ++i)
+    held = held && left[i] == clipped(levels[i * 2]) * 0.5f;
+  expect(held, "after the ramp the gain is exactly the target");
+
+  // Jumps without a ramp, and the Blip_Buffer int16 path
+  std::vector<int16_t> blip(NUM_SAMPLES);
+  for (int i = 0; i < NUM_SAMPLES; ++i)
+    blip[i] = static_cast<int16_t>(
+        std::clamp(levels[i * 2] * 4, -32768, 32767));
+  stage.setGain(0.25f, false);
+  stage.write(blip.data(), 1.0f / 32768.0f, left.data(), right.data(),
+              NUM_SAMPLES);
+  bool jumped = true;
+  for (int i = 0; i < NUM_SAMPLES; ++i)
+    jumped = jumped && left[i] == (blip[i] / 32768.0f) * 0.25f;
+  expect(jumped, "an unsmoothed change applies from the next sample");
+
+  return g_failures == 0 ? 0 : 1;
+}
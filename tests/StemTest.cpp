@@ -0,0 +1,151 @@
+// StemTest: Per-channel stems rendered alongside the mix
+// GPL-3.0
+//
+// Turning stems on must not change the mix. With one channel sounding per
+// core the nonlinear stems add up to the mix, since each core's nonlinear
+// DAC then sees a single channel. Linear stems bypass the DAC curve, so a
+// pulse below full volume comes out quieter than its nonlinear stem.
+// ChipStack sums the stems of its active chips like it sums the mix.
+
+#include "ChipStack.h"
+#include "NessyAPU.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr double SAMPLE_RATE = 44100.0;
+constexpr int BLOCK = 512;
+constexpr int NUM_BLOCKS = 24;
+constexpr int NUM_SAMPLES = BLOCK * NUM_BLOCKS;
+
+struct Output {
+  std::vector<float> left, right;
+  std::vector<float> stems[NessyAPU::NUM_CHANNELS];
+
+  Output() : left(NUM_SAMPLES), right(NUM_SAMPLES) {
+    for (auto &stem : stems)
+      stem.resize(NUM_SAMPLES);
+  }
+};
+
+struct Options {
+  bool stems = true;
+  bool nonlinear = true;
+  float velocity = 0.8f;
+};
+
+// Pulse 1, the triangle and the VRC6 saw, one channel per core, with a new
+// note every few blocks. (The triangle rests at a nonzero level even when
+// never played, so it is the one channel the DMC core can have sounding.)
+Output render(NessyAPU::RenderMode mode, const Options &options) {
+  NessyAPU apu;
+  apu.setStemsEnabled(options.stems);
+  apu.setStemNonlinear(options.nonlinear);
+  apu.initialize(SAMPLE_RATE);
+  apu.setRenderMode(mode);
+  apu.setVRC6Enabled(true);
+
+  Output out;
+  for (int b = 0; b < NUM_BLOCKS; ++b) {
+    if (b % 4 == 0) {
+      apu.noteOn(NessyAPU::PULSE1, 60 + b % 12, options.velocity);
+      apu.noteOn(NessyAPU::TRIANGLE, 45 + b % 7, 1.0f);
+      apu.noteOn(NessyAPU::VRC6_SAW, 48 + b % 5, 0.7f);
+    }
+    float *stems[NessyAPU::NUM_CHANNELS];
+    for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+      stems[c] = out.stems[c].data() + b * BLOCK;
+    apu.process(out.left.data() + b * BLOCK, out.right.data() + b * BLOCK,
+                stems, BLOCK);
+  }
+  return out;
+}
+
+float peak(const std::vector<float> &a) {
+  float p = 0.0f;
+  for (float x : a)
+    p = std::max(p, std::fabs(x));
+  return p;
+}
+
+bool testMode(NessyAPU::RenderMode mode) {
+  Options plainOptions;
+  plainOptions.stems = false;
+  const Output plain = render(mode, plainOptions);
+  const Output withStems = render(mode, Options());
+
+  bool ok = check(maxDiff(plain.left, withStems.left) == 0.0f &&
+                      maxDiff(plain.right, withStems.right) == 0.0f,
+                  mode, "stems leave the mix unchanged");
+
+  bool cleared = true;
+  for (const auto &stem : plain.stems)
+    cleared = cleared && peak(stem) == 0.0f;
+  ok = check(cleared, mode, "stem outputs are cleared with stems off") && ok;
+
+  std::vector<float> sum(NUM_SAMPLES, 0.0f);
+  for (const auto &stem : withStems.stems)
+    for (int i = 0; i < NUM_SAMPLES; ++i)
+      sum[i] += stem[i];
+  const float diff = maxDiff(sum, withStems.left);
+  ok = check(diff < 1e-4f &&
+                 peak(withStems.stems[NessyAPU::PULSE1]) > 0.05f &&
+                 peak(withStems.stems[NessyAPU::VRC6_SAW]) > 0.05f,
+             mode, "one channel per core: the stems add up to the mix") &&
+       ok;
+
+  Options quiet;
+  quiet.velocity = 0.5f;
+  const Output nonlinearQuiet = render(mode, quiet);
+  quiet.nonlinear = false;
+  const Output linearQuiet = render(mode, quiet);
+  ok = check(maxDiff(nonlinearQuiet.left, linearQuiet.left) == 0.0f &&
+                 peak(linearQuiet.stems[NessyAPU::PULSE1]) <
+                     peak(nonlinearQuiet.stems[NessyAPU::PULSE1]) * 0.95f,
+             mode, "linear stems bypass the DAC curve, not the mix") &&
+       ok;
+  return ok;
+}
+
+// Two chips playing the same notes give twice the stems of one
+bool testChipStack() {
+  float stems[2][NessyAPU::NUM_CHANNELS][BLOCK];
+  for (int numChips = 1; numChips <= 2; ++numChips) {
+    ChipStack stack(0);
+    stack.forEachChip([](NessyAPU &apu) { apu.setStemsEnabled(true); });
+    stack.initialize(SAMPLE_RATE);
+    stack.setNumChips(numChips);
+    for (int i = 0; i < numChips; ++i)
+      stack.getChip(i).noteOn(NessyAPU::TRIANGLE, 45, 1.0f);
+
+    float left[BLOCK], right[BLOCK];
+    float *outputs[NessyAPU::NUM_CHANNELS];
+    for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+      outputs[c] = stems[numChips - 1][c];
+    stack.process(left, right, outputs, BLOCK);
+  }
+
+  float diff = 0.0f;
+  for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+    for (int i = 0; i < BLOCK; ++i)
+      diff = std::max(diff,
+                      std::fabs(stems[1][c][i] - 2.0f * stems[0][c][i]));
+  const bool ok = diff < 1e-6f;
+  std::printf("%s chip stack sums the chips' stems\n", ok ? "ok  " : "FAIL");
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  bool ok = true;
+  for (auto mode : RENDER_MODES)
+    ok = testMode(mode) && ok;
+  ok = testChipStack() && ok;
+  return ok ? 0 : 1;
+}
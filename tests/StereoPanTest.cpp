@@ -0,0 +1,118 @@
+// StereoPanTest: Channel pans through the cores' stereo mix
+// GPL-3.0
+//
+// Centred pans must leave the output exactly as it was, with both sides
+// equal. Pulse 1 alone panned hard left must leave the right side as if it
+// were muted (the 2A03 cores still sit at their DC level there). And going
+// from mono to stereo mid-stream must not disturb the signal: panning a
+// silent channel leaves both sides matching the mono render, which in the
+// bandlimited mode means the right Blip_Buffer takes over the left one's
+// state.
+
+#include "NessyAPU.h"
+#include "TestUtil.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+constexpr double SAMPLE_RATE = 44100.0;
+constexpr int BLOCK = 512;
+constexpr int NUM_BLOCKS = 24;
+
+struct Output {
+  std::vector<float> left, right;
+};
+
+// Pulses, triangle and noise with a change every few blocks; onBlock runs
+// before each block is rendered
+template <typename OnBlock>
+Output render(NessyAPU::RenderMode mode, OnBlock onBlock) {
+  NessyAPU apu;
+  apu.initialize(SAMPLE_RATE);
+  apu.setRenderMode(mode);
+
+  Output out{std::vector<float>(BLOCK * NUM_BLOCKS),
+             std::vector<float>(BLOCK * NUM_BLOCKS)};
+  for (int b = 0; b < NUM_BLOCKS; ++b) {
+    onBlock(apu, b);
+    if (b % 4 == 0) {
+      apu.noteOn(NessyAPU::PULSE1, 60 + b % 12, 0.8f);
+      apu.noteOn(NessyAPU::PULSE2, 67 - b % 7, 0.6f);
+      apu.noteOn(NessyAPU::TRIANGLE, 45 + b % 5, 1.0f);
+      apu.noteOn(NessyAPU::NOISE, 50 + b, 0.5f);
+    }
+    apu.process(out.left.data() + b * BLOCK, out.right.data() + b * BLOCK,
+                BLOCK);
+  }
+  return out;
+}
+
+bool testMode(NessyAPU::RenderMode mode) {
+  const Output plain = render(mode, [](NessyAPU &, int) {});
+  bool ok = check(maxDiff(plain.left, plain.right) == 0.0f, mode,
+                  "untouched pans give equal sides");
+
+  // Panned away and back to centre before the first note
+  const Output centred = render(mode, [](NessyAPU &apu, int b) {
+    if (b == 0) {
+      for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+        apu.setChannelPan(c, 0.7f);
+      for (int c = 0; c < NessyAPU::NUM_CHANNELS; ++c)
+        apu.setChannelPan(c, 0.0f);
+    }
+  });
+  ok = check(maxDiff(plain.left, centred.left) == 0.0f &&
+                 maxDiff(plain.right, centred.right) == 0.0f,
+             mode, "centred pans match the mono output exactly") &&
+       ok;
+
+  // Pulse 1 on its own hard left, against everything muted. The other
+  // channels are off because the nonlinear mix shares out the pulse pair's
+  // level between both pulses.
+  const auto pulse1Only = [](NessyAPU &apu) {
+    apu.setChannelEnabled(NessyAPU::PULSE2, false);
+    apu.setChannelEnabled(NessyAPU::TRIANGLE, false);
+    apu.setChannelEnabled(NessyAPU::NOISE, false);
+  };
+  const Output hardLeft = render(mode, [&](NessyAPU &apu, int b) {
+    if (b == 0) {
+      pulse1Only(apu);
+      apu.setChannelPan(NessyAPU::PULSE1, -1.0f);
+    }
+  });
+  const Output muted = render(mode, [&](NessyAPU &apu, int b) {
+    if (b == 0) {
+      pulse1Only(apu);
+      apu.setChannelEnabled(NessyAPU::PULSE1, false);
+    }
+  });
+  ok = check(maxDiff(hardLeft.right, muted.right) < 1e-6f &&
+                 maxDiff(hardLeft.left, muted.left) > 0.05f,
+             mode, "a hard left channel is missing on the right") &&
+       ok;
+
+  // Mono to stereo mid-stream by panning the silent VRC6 saw
+  const Output switched = render(mode, [](NessyAPU &apu, int b) {
+    if (b == NUM_BLOCKS / 2)
+      apu.setChannelPan(NessyAPU::VRC6_SAW, 1.0f);
+  });
+  const float diff = std::max(maxDiff(plain.left, switched.left),
+                              maxDiff(plain.right, switched.right));
+  ok = check(diff < 1e-6f, mode,
+             "switching to stereo mid-stream leaves the signal alone") &&
+       ok;
+  return ok;
+}
+
+} // namespace
+
+int main() {
+  bool ok = true;
+  for (auto mode : RENDER_MODES)
+    ok = testMode(mode) && ok;
+  return ok ? 0 : 1;
+}
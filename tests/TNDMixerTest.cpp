@@ -0,0 +1,83 @@
+// TNDMixerTest: Checks NES_DMC's shared TND mixer against the 256KB
+// tnd_table formula it replaced
+// GPL-3.0
+
+#include "nsfplay/xgm/devices/Sound/nes_dmc.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+// Largest accepted difference, in mixer units, from the old table. The
+// linear levels are computed with the same double expressions as the old
+// table, so they are expected to be exact. The DAC table is indexed by the
+// channels' weighted sum with the weights rounded to integers, which moves
+// an entry by at most 1 of the roughly 6075 at full level. The DAC table
+// stores UINT16, so the old table's peak must fit in one, and it has to
+// stay small enough to share L1 with the cores' state.
+constexpr long MAX_LINEAR_ERROR = 0;
+constexpr long MAX_VOLTAGE_ERROR = 1;
+constexpr long MAX_VOLTAGE = 0xFFFF;
+constexpr size_t MAX_DAC_BYTES = 8192;
+
+// DAC weights used by the old table; volatile so the compiler cannot fold
+// the reference formula into constants
+volatile double g_weights[3] = {8227.0, 12241.0, 22638.0};
+
+} // namespace
+
+int main() {
+  using xgm::NES_DMC;
+  using xgm::UINT32;
+
+  const NES_DMC::TNDMixer &mixer = NES_DMC::GetTNDMixer();
+  const double MASTER = 8192.0;
+  const double wt = g_weights[0], wn = g_weights[1], wd = g_weights[2];
+
+  long linearError = 0, voltageError = 0, peak = 0;
+  for (int t = 0; t < 16; ++t)
+    for (int n = 0; n < 16; ++n)
+      for (int d = 0; d < 128; ++d) {
+        // Linear mixer: the old tnd_table[0][t][n][d]
+        const UINT32 linear = (UINT32)(MASTER * (3.0 * t + 2.0 * n + d) / 208.0);
+        if (n == 0 && d == 0)
+          linearError = std::max(linearError, std::labs((long)mixer.tri[t] -
+                                                        (long)linear));
+        if (t == 0 && d == 0)
+          linearError = std::max(linearError, std::labs((long)mixer.noise[n] -
+                                                        (long)linear));
+        if (t == 0 && n == 0)
+          linearError = std::max(linearError, std::labs((long)mixer.dmc[d] -
+                                                        (long)linear));
+
+        // Nonlinear mixer: the old tnd_table[1][t][n][d]
+        UINT32 voltage = 0;
+        if (t || n || d)
+          voltage = (UINT32)((MASTER * 159.79) /
+                             (100.0 + 1.0 / ((double)t / wt + (double)n / wn +
+                                             (double)d / wd)));
+        peak = std::max(peak, (long)voltage);
+        voltageError = std::max(
+            voltageError, std::labs((long)mixer.voltage(t, n, d) -
+                                    (long)voltage));
+      }
+
+  const size_t dacBytes = sizeof(mixer.dac);
+  const bool ok = linearError <= MAX_LINEAR_ERROR &&
+                  voltageError <= MAX_VOLTAGE_ERROR && peak <= MAX_VOLTAGE &&
+                  dacBytes <= MAX_DAC_BYTES;
+  std::printf("%s linear max error %ld (bound %ld)\n",
+              linearError <= MAX_LINEAR_ERROR ? "ok  " : "FAIL", linearError,
+              MAX_LINEAR_ERROR);
+  std::printf("%s nonlinear max error %ld (bound %ld)\n",
+              voltageError <= MAX_VOLTAGE_ERROR ? "ok  " : "FAIL",
+              voltageError, MAX_VOLTAGE_ERROR);
+  std::printf("%s nonlinear peak %ld (table limit %ld)\n",
+              peak <= MAX_VOLTAGE ? "ok  " : "FAIL", peak, MAX_VOLTAGE);
+  std::printf("%s nonlinear table %zu bytes (bound %zu)\n",
+              dacBytes <= MAX_DAC_BYTES ? "ok  " : "FAIL", dacBytes,
+              MAX_DAC_BYTES);
+  return ok ? 0 : 1;
+}
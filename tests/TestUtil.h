@@ -0,0 +1,43 @@
+#pragma once
+
+// TestUtil: Helpers shared by the tests and the benchmark
+// GPL-3.0
+
+#include "NessyAPU.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+// Every render mode, for tests that check each of them
+constexpr NessyAPU::RenderMode RENDER_MODES[] = {
+    NessyAPU::RenderMode::SAMPLED, NessyAPU::RenderMode::EVENT_DRIVEN,
+    NessyAPU::RenderMode::BANDLIMITED};
+
+// Render mode name used in test output and benchmark results
+inline const char *modeName(NessyAPU::RenderMode mode) {
+  switch (mode) {
+  case NessyAPU::RenderMode::SAMPLED:
+    return "sampled";
+  case NessyAPU::RenderMode::EVENT_DRIVEN:
+    return "event_driven";
+  case NessyAPU::RenderMode::BANDLIMITED:
+    return "bandlimited";
+  }
+  return "unknown";
+}
+
+// Largest absolute difference between two renders of the same length
+inline float maxDiff(const std::vector<float> &a, const std::vector<float> &b) {
+  float diff = 0.0f;
+  for (size_t i = 0; i < a.size(); ++i)
+    diff = std::max(diff, std::fabs(a[i] - b[i]));
+  return diff;
+}
+
+// Prints one result line for a render mode and passes ok through
+inline bool check(bool ok, NessyAPU::RenderMode mode, const char *what) {
+  std::printf("%s %-13s %s\n", ok ? "ok  " : "FAIL", modeName(mode), what);
+  return ok;
+}
@@ -0,0 +1,77 @@
+// VoiceAllocatorTest: Multitimbral routing by MIDI channel
+// GPL-3.0
+//
+// Checks that each MIDI channel plays on its channel group, that the same
+// note on two MIDI channels holds two voices which release independently,
+// and that VRC6 groups fall back to the 2A03 while VRC6 is disabled.
+
+#include "NessyAPU.h"
+#include "VoiceAllocator.h"
+
+#include <cstdio>
+
+namespace {
+
+int g_failures = 0;
+
+void expect(bool condition, const char *what) {
+  std::printf("%s %s\n", condition ? "ok  " : "FAIL", what);
+  if (!condition)
+    ++g_failures;
+}
+
+} // namespace
+
+int main() {
+  NessyAPU apu;
+  apu.initialize(48000.0);
+
+  VoiceAllocator voices;
+  voices.setAPU(&apu);
+  voices.setMode(VoiceAllocator::Mode::MULTITIMBRAL);
+
+  voices.noteOn(0, 60, 1.0f);
+  voices.noteOn(1, 60, 1.0f);
+  voices.noteOn(2, 48, 1.0f);
+  voices.noteOn(9, 40, 1.0f);
+  expect(voices.getChannelForNote(0, 60) == NessyAPU::PULSE1,
+         "MIDI channel 1 plays Pulse 1");
+  expect(voices.getChannelForNote(1, 60) == NessyAPU::PULSE2,
+         "MIDI channel 2 plays Pulse 2");
+  expect(voices.getChannelForNote(2, 48) == NessyAPU::TRIANGLE,
+         "MIDI channel 3 plays Triangle");
+  expect(voices.getChannelForNote(9, 40) == NessyAPU::NOISE,
+         "MIDI channel 10 plays Noise");
+
+  voices.noteOff(0, 60);
+  expect(voices.getChannelForNote(0, 60) < 0 &&
+             voices.getChannelForNote(1, 60) == NessyAPU::PULSE2,
+         "note-off releases only its own MIDI channel");
+
+  // A second note on a one-channel group takes the channel over
+  voices.noteOn(2, 43, 1.0f);
+  expect(voices.getChannelForNote(2, 48) < 0 &&
+             voices.getChannelForNote(2, 43) == NessyAPU::TRIANGLE,
+         "a full group steals its oldest voice");
+
+  voices.allNotesOff();
+  voices.noteOn(6, 36, 1.0f);
+  expect(voices.getChannelForNote(6, 36) == NessyAPU::TRIANGLE,
+         "VRC6 Saw falls back to Triangle without VRC6");
+
+  voices.setVRC6Enabled(true);
+  apu.setVRC6Enabled(true);
+  voices.noteOn(6, 38, 1.0f);
+  expect(voices.getChannelForNote(6, 38) == NessyAPU::VRC6_SAW,
+         "MIDI channel 7 plays VRC6 Saw");
+
+  voices.setChannelGroup(3, (1 << NessyAPU::PULSE2) |
+                                (1 << NessyAPU::VRC6_PULSE1));
+  voices.noteOn(3, 70, 1.0f);
+  voices.noteOn(3, 72, 1.0f);
+  expect(voices.getChannelForNote(3, 70) == NessyAPU::PULSE2 &&
+             voices.getChannelForNote(3, 72) == NessyAPU::VRC6_PULSE1,
+         "a custom group spreads over its channels");
+
+  return g_failures == 0 ? 0 : 1;
+}